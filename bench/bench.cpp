@@ -0,0 +1,1181 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "simd.h"
+#include "ch_range.h"
+#include "http_request.h"
+#include "board_scan.h"
+#include "utils.h"
+#include "config.h"
+#include "trace.h"
+#include "routes.h"
+#include "boards.h"
+#include "captures.h"
+
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include <dirent.h>
+
+/*
+ *	Microbenchmarks of the parsing core - ch_range, the request
+ *	parser, percent_decode and the board scanner - run over a
+ *	set of PUT /board requests. The requests are either made up
+ *	here at a few board sizes, or read from a folder of raw ones,
+ *	or the largest few are taken from a capture made with "-t".
+ *
+ *	A few checks of the fast paths run first and, if any fails,
+ *	nothing is timed and the exit code is 3.
+ *
+ *	Results go to stdout as JSON, in a fixed order and format, so
+ *	that runs can be diffed and fed to compare.py.
+ */
+struct corpus
+{
+	string  name;
+	string  raw;     // the whole request
+	size_t  head;    // bytes, incl. the \r\n\r\n
+	string  body;    // urlencoded form
+	string  data;    // its "data" field, decoded
+};
+
+struct result
+{
+	string  name;
+	string  corpus;
+	size_t  bytes;    // per op
+	double  ns;       // per op, median of the reps
+};
+
+struct options
+{
+	string  dir;        // of *.http files, made up if empty
+	string  capture;    // or a capture file
+	string  filter;
+	double  min_ms;     // per rep
+	int     reps;
+
+	options() { min_ms = 100; reps = 5; }
+};
+
+static volatile size_t sink; // keeps the results alive
+
+/*
+ *	corpora
+ */
+static bool split_request(corpus & c)
+{
+	size_t at = c.raw.find("\r\n\r\n");
+	char * p;
+
+	if (at == string::npos)
+		return false;
+
+	c.head = at + 4;
+	c.body = c.raw.substr(c.head);
+
+	// the first "data" field, decoded
+
+	c.data.clear();
+
+	for (size_t i = 0; i < c.body.size(); )
+	{
+		size_t amp = c.body.find('&', i);
+
+		if (amp == string::npos)
+			amp = c.body.size();
+
+		if (! c.body.compare(i, 5, "data="))
+		{
+			c.data = c.body.substr(i + 5, amp - i - 5);
+			p = c.data.size() ? &c.data[0] : NULL;
+			c.data.resize(percent_decode(p, c.data.size()));
+			break;
+		}
+
+		i = amp + 1;
+	}
+
+	return true;
+}
+
+static void make_corpora(vector<corpus> & out)
+{
+	static const size_t sizes[] = { 2*1024, 64*1024, 1024*1024 };
+
+	for (size_t size : sizes)
+	{
+		corpus c;
+
+		c.name = stringf("board-%zuk", size / 1024);
+		c.raw  = board_request(make_board(size, 1618261845169ull, 42), 1618261845169ull, 42, "9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e");
+
+		split_request(c);
+		out.push_back(c);
+	}
+}
+
+static bool load_corpora(const string & dir, vector<corpus> & out)
+{
+	DIR * d = opendir(dir.c_str());
+	vector<string> names;
+	dirent * e;
+
+	if (! d)
+	{
+		fprintf(stderr, "Can't open %s\n", dir.c_str());
+		return false;
+	}
+
+	while ((e = readdir(d)))
+	{
+		string n = e->d_name;
+
+		if (n.size() > 5 && n.compare(n.size() - 5, 5, ".http") == 0)
+			names.push_back(n);
+	}
+
+	closedir(d);
+
+	std::sort(names.begin(), names.end());
+
+	for (auto & n : names)
+	{
+		FILE * f = fopen((dir + "/" + n).c_str(), "rb");
+		corpus c;
+		char   buf[64*1024];
+		size_t got;
+
+		if (! f)
+			continue;
+
+		while ((got = fread(buf, 1, sizeof buf, f)))
+			c.raw.append(buf, got);
+
+		fclose(f);
+
+		c.name = n.substr(0, n.size() - 5);
+
+		if (! split_request(c))
+		{
+			fprintf(stderr, "%s is not an HTTP request, skipped\n", n.c_str());
+			continue;
+		}
+
+		out.push_back(c);
+	}
+
+	if (out.empty())
+	{
+		fprintf(stderr, "No *.http files in %s\n", dir.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ *	The requests are put together from their head and body records
+ *	per connection, and the largest of them are kept, in the order
+ *	they came in.
+ */
+static const size_t max_captured = 8;
+
+static bool load_captured(const string & file, vector<corpus> & out)
+{
+	string   data, stem;
+	map<uint32_t, corpus> open;
+	vector<corpus>        all;
+	cap_record   r;
+	const char * p;
+	size_t       seq = 0;
+
+	if (! load_capture(file, data))
+		return false;
+
+	stem = file.substr(file.find_last_of('/') + 1);
+	stem = stem.substr(0, stem.find('.'));
+
+	auto done = [&](uint32_t conn)
+	{
+		auto i = open.find(conn);
+
+		if (i == open.end())
+			return;
+
+		if (split_request(i->second))
+			all.push_back(i->second);
+
+		open.erase(i);
+	};
+
+	cap_reader rd(data);
+
+	while (rd.next(r, p))
+	{
+		if (r.kind == cap_start)
+		{
+			while (open.size())
+				done(open.begin()->first);
+		}
+		else
+		if (r.kind == cap_head)
+		{
+			done(r.conn);
+			open[r.conn].name = stringf("%s-%04zu", stem.c_str(), ++seq);
+			open[r.conn].raw.assign(p, r.len);
+		}
+		else
+		if (r.kind == cap_body && open.count(r.conn))
+		{
+			open[r.conn].raw.append(p, r.len);
+		}
+		else
+		if (r.kind == cap_close)
+		{
+			done(r.conn);
+		}
+	}
+
+	while (open.size())
+		done(open.begin()->first);
+
+	if (rd.cut_short())
+		fprintf(stderr, "%s is cut short at %zu, using what's before it\n", file.c_str(), rd.at);
+
+	if (all.empty())
+	{
+		fprintf(stderr, "No requests in %s\n", file.c_str());
+		return false;
+	}
+
+	// the largest, then back in order
+
+	std::stable_sort(all.begin(), all.end(), [](const corpus & a, const corpus & b) { return a.raw.size() > b.raw.size(); });
+
+	if (all.size() > max_captured)
+		all.resize(max_captured);
+
+	std::sort(all.begin(), all.end(), [](const corpus & a, const corpus & b) { return a.name < b.name; });
+
+	out.insert(out.end(), all.begin(), all.end());
+	return true;
+}
+
+/*
+ *	the runner
+ */
+typedef std::chrono::steady_clock bench_clock;
+
+static double time_op(const std::function<void()> & op, const options & opt)
+{
+	vector<double> reps;
+	size_t batch = 1;
+
+	// size a batch to take about a 10th of a rep
+
+	for (;;)
+	{
+		auto t0 = bench_clock::now();
+
+		for (size_t i=0; i<batch; i++)
+			op();
+
+		double ms = std::chrono::duration<double, std::milli>(bench_clock::now() - t0).count();
+
+		if (ms >= opt.min_ms / 10 || batch >= ((size_t)1 << 30))
+			break;
+
+		batch *= 2;
+	}
+
+	for (int r=0; r<opt.reps; r++)
+	{
+		auto   t0 = bench_clock::now();
+		size_t n = 0;
+		double ms;
+
+		do
+		{
+			for (size_t i=0; i<batch; i++)
+				op();
+
+			n += batch;
+			ms = std::chrono::duration<double, std::milli>(bench_clock::now() - t0).count();
+
+		} while (ms < opt.min_ms);
+
+		reps.push_back(ms * 1e6 / n);
+	}
+
+	std::sort(reps.begin(), reps.end());
+	return reps[reps.size() / 2];
+}
+
+static void run(vector<result> & out, const options & opt, const string & name, const corpus & c, size_t bytes, const std::function<void()> & op)
+{
+	result r;
+
+	if (opt.filter.size() && name.find(opt.filter) == string::npos)
+		return;
+
+	r.name   = name;
+	r.corpus = c.name;
+	r.bytes  = bytes;
+	r.ns     = time_op(op, opt);
+
+	fprintf(stderr, "%-32s %-16s %12.1f ns\n", name.c_str(), c.name.c_str(), r.ns);
+	out.push_back(r);
+}
+
+/*
+ *	checks, run ahead of the benchmarks so that the variants and
+ *	fast paths being timed are known to be right
+ */
+static int failed;
+
+static string printable(const char * p, size_t n)
+{
+	string r;
+
+	for (size_t i=0; i<n; i++)
+		r += (' ' <= p[i] && p[i] < 0x7f) ? string(1, p[i]) : stringf("\\x%02x", (uint8_t)p[i]);
+
+	return r;
+}
+
+static void check(bool ok, const char * what, const char * p = "", size_t n = 0)
+{
+	if (ok)
+		return;
+
+	fprintf(stderr, "FAILED: %s [%s]\n", what, printable(p, n).c_str());
+	failed++;
+}
+
+// the reference, with room for the overflow
+static bool ref_parse_uint(const char * p, size_t n, unsigned __int128 max, uint64_t & val)
+{
+	unsigned __int128 r = 0;
+
+	if (! n)
+		return false;
+
+	for (size_t i=0; i<n; i++)
+	{
+		if (p[i] < '0' || '9' < p[i])
+			return false;
+
+		r = r * 10 + (p[i] - '0');
+
+		if (r > max)
+			return false;
+	}
+
+	val = (uint64_t)r;
+	return true;
+}
+
+static void check_uint(const string & str)
+{
+	ch_range in((char*)str.data(), str.size());
+	uint64_t ref, v64 = 0;
+	uint32_t v32 = 0;
+	bool     ok;
+
+	ok = ref_parse_uint(str.data(), str.size(), (uint64_t)-1, ref);
+	check(in.to_u64(v64) == ok && (! ok || v64 == ref), "to_u64", str.data(), str.size());
+
+	ok = ref_parse_uint(str.data(), str.size(), (uint32_t)-1, ref);
+	check(in.to_u32(v32) == ok && (! ok || v32 == ref), "to_u32", str.data(), str.size());
+}
+
+static void check_to_uint()
+{
+	static const char * edges[] =
+	{
+		"", "0", "00000000000000000000000042",
+		"4294967295", "4294967296", "04294967295", "42949672950",
+		"18446744073709551615", "18446744073709551616", "18446744073709551620",
+		"018446744073709551615", "99999999999999999999", "184467440737095516150",
+		"+1", "-1", " 1", "1 ", "1a", "0x10", "1e3", "/", ":", "1.5",
+	};
+
+	static const char junk[] = "0123456789 +-/:.xe\x80\xff";
+
+	for (auto e : edges)
+		check_uint(e);
+
+	check_uint(string("1\0", 2));
+
+	// around the limits, and made up
+
+	for (uint64_t base : { (uint64_t)0xffffffff, (uint64_t)-1 })
+		for (uint64_t d = 0; d < 64; d++)
+		{
+			check_uint(stringf("%llu", (unsigned long long)(base - d)));
+			check_uint(stringf("%llu%llu", (unsigned long long)(base / 10 + d / 8), d % 8 + 2));
+		}
+
+	rng r(1);
+
+	for (int i=0; i<1000000; i++)
+	{
+		string str(r.below(24), '0');
+
+		for (auto & ch : str)
+			ch = r.below(20) ? '0' + r.below(10) : junk[r.below(sizeof junk - 1)];
+
+		check_uint(str);
+	}
+}
+
+/*
+ *	find() variants against the scalar one, for every length and
+ *	alignment of the haystack within a couple of vectors
+ */
+static void check_find()
+{
+	typedef char * (* find_char_fn)(const char *, size_t, char);
+	typedef char * (* find_str_fn)(const char *, size_t, const char *, size_t);
+
+	vector<std::pair<find_char_fn, find_str_fn>> fns;
+	char buf[128];
+	rng  r(3);
+
+	if (cpu_has_sse2()) fns.push_back({ ch_find_char_sse2, ch_find_str_sse2 });
+	if (cpu_has_avx2()) fns.push_back({ ch_find_char_avx2, ch_find_str_avx2 });
+
+	for (int i=0; i<20000; i++)
+	{
+		size_t at  = r.below(32);
+		size_t len = r.below(sizeof buf - at);
+		size_t n   = 1 + r.below(4);
+
+		// few distinct chars, so that there are partial matches
+		for (auto & ch : buf)
+			ch = "ab%&"[r.below(4)];
+
+		const char * what = buf + r.below(sizeof buf - n);
+		char         ch   = "ab%&x"[r.below(5)];
+
+		for (auto & f : fns)
+		{
+			check(f.first(buf + at, len, ch) == ch_find_char_scalar(buf + at, len, ch), "ch_find_char", buf + at, len);
+			check(f.second(buf + at, len, what, n) == ch_find_str_scalar(buf + at, len, what, n), "ch_find_str", buf + at, len);
+		}
+	}
+}
+
+/*
+ *	json_skip_string() variants against the scalar one, over text
+ *	thick with escapes, good and bad, that run across the vectors
+ *	and past the end
+ */
+static void check_skip_string()
+{
+	typedef const char * (* skip_fn)(const char *, const char *);
+
+	static const char * bits[] = { "a", "bc", "\\n", "\\\"", "\\\\", "\\u00e9", "\\uD83D", "\\u12", "\\x", "\\", "\"", "\t" };
+
+	vector<skip_fn> fns;
+	char buf[128];
+	rng  r(4);
+
+	if (cpu_has_sse2()) fns.push_back(json_skip_string_sse2);
+	if (cpu_has_avx2()) fns.push_back(json_skip_string_avx2);
+
+	for (int i=0; i<20000; i++)
+	{
+		size_t at  = r.below(32);
+		size_t len = r.below(sizeof buf - at);
+		size_t n   = 0;
+
+		// mostly plain, with a special in every so many bytes
+		while (n < sizeof buf)
+		{
+			const char * b = r.below(8) ? bits[r.below(2)] : bits[r.below(sizeof bits / sizeof *bits)];
+
+			for ( ; *b && n < sizeof buf; b++)
+				buf[n++] = *b;
+		}
+
+		for (auto f : fns)
+			check(f(buf + at, buf + at + len) == json_skip_string_scalar(buf + at, buf + at + len), "json_skip_string", buf + at, len);
+	}
+}
+
+/*
+ *	The board scanner fed whole and a byte at a time, which keeps
+ *	it off its fast lane, over a board and over copies of it with
+ *	a byte or two changed. Both ways must agree on all of it.
+ */
+static string scan_result(const string & data, size_t piece)
+{
+	board_scan scan;
+	bool       ok = true;
+
+	for (size_t at = 0; at < data.size() && ok; at += piece)
+		ok = scan.feed(ch_range(&data[at], std::min(piece, data.size() - at)));
+
+	ok = ok && scan.finish();
+
+	return stringf("%d %s %d%d%llu %d%d%llu %d%d%llu %d[%s]", ok, ok ? "" : scan.error,
+		scan.format.seen, scan.format.ok, (unsigned long long)scan.format.val,
+		scan.id.seen, scan.id.ok, (unsigned long long)scan.id.val,
+		scan.revision.seen, scan.revision.ok, (unsigned long long)scan.revision.val,
+		scan.has_title, scan.title.c_str());
+}
+
+static void check_board_scan()
+{
+	static const char junk[] = "{}[]:,\"\\ \t0-1.eE+tfnux\x01";
+
+	string board = make_board(2*1024, 1618261845169ull, 42);
+	rng    r(5);
+
+	check(scan_result(board, board.size()) == scan_result(board, 1), "board_scan", board.data(), board.size());
+	check(scan_result(board, board.size())[0] == '1', "board_scan: the board is malformed");
+
+	for (int i=0; i<5000; i++)
+	{
+		string data = board;
+
+		for (int k = 1 + (int)r.below(2); k; k--)
+			data[r.below(data.size())] = junk[r.below(sizeof junk - 1)];
+
+		check(scan_result(data, data.size()) == scan_result(data, 1), "board_scan", data.data(), data.size());
+	}
+}
+
+/*
+ *	Heap allocations other than the arena's, from the containers
+ */
+static size_t news;
+static size_t new_bytes;
+
+void * operator new(size_t n)
+{
+	void * p = malloc(n ? n : 1);
+
+	if (! p)
+		throw std::bad_alloc();
+
+	news++;
+	new_bytes += n;
+	return p;
+}
+
+// not inlined, or gcc takes the free() for a mismatch with the new
+__attribute__((noinline)) void operator delete(void * p) noexcept         { free(p); }
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept { free(p); }
+
+/*
+ *	Requests parsed one after another into the same http_req, as
+ *	the engine does on a connection
+ */
+static bool parse_again(http_req & req, string & raw)
+{
+	sk_conn conn;
+	int     rc;
+
+	conn.buf.ptr = &raw[0];
+	conn.buf.cap = raw.size();
+	conn.fill = raw.size();
+
+	req.reset();
+	rc = parse_http_request(conn, req);
+
+	conn.buf.ptr = NULL; // not from sk_bufs
+	return rc > 0;
+}
+
+// once the first request is in, its arena block takes the rest
+static void check_arena()
+{
+	string   raw = board_request(make_board(2*1024, 1618261845169ull, 42), 1618261845169ull, 42, "9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e");
+	http_req req;
+	size_t   warm;
+
+	check(parse_again(req, raw), "arena: parse_http_request");
+	warm = req.mem.heap_allocs();
+
+	for (int i=0; i<100; i++)
+		parse_again(req, raw);
+
+	check(warm == 1, "arena: first request heap allocations != 1");
+	check(req.mem.heap_allocs() == warm, "arena: heap allocations after the first request");
+}
+
+// requests with no body, past the first one, touch no heap at all
+static void check_no_clen()
+{
+	static const char * heads[] =
+	{
+		"GET /metrics HTTP/1.1\r\n"
+		"Host: 127.0.0.1:10001\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n",
+
+		"PUT /test HTTP/1.1\r\n"
+		"Host: 127.0.0.1:10001\r\n"
+		"Origin: null\r\n"
+		"X-Access-Token: 9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n",
+	};
+
+	for (auto h : heads)
+	{
+		string   raw = h;
+		http_req req;
+		size_t   n, m;
+
+		check(parse_again(req, raw), "no clen: parse_http_request", h, strlen(h));
+
+		n = news;
+		m = req.mem.heap_allocs();
+
+		for (int i=0; i<100; i++)
+		{
+			parse_again(req, raw);
+			check(! req.header(hh_content_length), "no clen: Content-Length found", h, strlen(h));
+		}
+
+		check(news == n && req.mem.heap_allocs() == m, "no clen: heap allocations after the first request", h, strlen(h));
+	}
+}
+
+// every route matches its own request and nothing else does
+static void check_routes()
+{
+	static const struct { int verb; const char * path; int route; } reqs[] =
+	{
+		{ vb_put,     "/test",                  rt_put_test    },
+		{ vb_put,     "/CONFIG",                rt_put_config  },
+		{ vb_put,     "/board/1618261845169",   rt_put_board   },
+		{ vb_delete,  "/Board/1618261845169",   rt_del_board   },
+		{ vb_get,     "/metrics",               rt_get_metrics },
+		{ vb_get,     "/spans",                 rt_get_spans   },
+		{ vb_get,     "/test",                  rt_none        },
+		{ vb_put,     "/test/",                 rt_none        },
+		{ vb_put,     "/tests",                 rt_none        },
+		{ vb_put,     "/board",                 rt_none        },
+		{ vb_put,     "/board/",                rt_none        },
+		{ vb_put,     "/board/12x",             rt_none        },
+		{ vb_put,     "/board/18446744073709551616", rt_none   },
+		{ vb_put,     "/board/1/",              rt_none        },
+		{ vb_options, "/board/1",               rt_none        },
+		{ vb_get,     "/",                      rt_none        },
+		{ vb_get,     "",                       rt_none        },
+		{ vb_get,     "metrics",                rt_none        },
+	};
+
+	for (auto & r : reqs)
+	{
+		ch_range id;
+		int      rt = find_route(r.verb, ch_range(r.path), id);
+
+		check(rt == r.route, "find_route", r.path, strlen(r.path));
+
+		if (rt == rt_put_board || rt == rt_del_board)
+			check(id.match("1618261845169"), "find_route: id", r.path, strlen(r.path));
+	}
+
+	for (int rt = rt_none + 1; rt < rt_count; rt++)
+		check(*route_name(rt) != 0, "route_name");
+}
+
+/*
+ *	A board save's body through form_reader and percent_decode,
+ *	the way the engine reads it - in place, a buffer at a time,
+ *	with meta and self appended to strings. The only allocations
+ *	are those strings, whatever the size of the data.
+ */
+static void check_payload_allocs()
+{
+	static const size_t sizes[] = { 64*1024, 1024*1024 };
+	static const size_t conn_buf = 64*1024;
+
+	for (size_t size : sizes)
+	{
+		string      raw = board_request(make_board(size, 1618261845169ull, 42), 1618261845169ull, 42, "9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e");
+		string      body = raw.substr(raw.find("\r\n\r\n") + 4);
+		string      buf, meta, self;
+		form_reader form;
+		size_t      at = 0, data = 0, n, bytes;
+
+		buf.reserve(conn_buf);
+
+		n = news;
+		bytes = new_bytes;
+
+		while (at < body.size() || buf.size())
+		{
+			size_t   add = std::min(conn_buf - buf.size(), body.size() - at);
+			bool     last;
+			ch_range in, piece;
+
+			buf.append(body, at, add);
+			at += add;
+
+			last = (at == body.size());
+			in = ch_range(buf);
+
+			while (form.next(in, last, piece))
+			{
+				if (form.key == "data") data += piece.size; else
+				if (form.key == "meta") meta.append(piece.data, piece.size); else
+				if (form.key == "self") self.append(piece.data, piece.size);
+			}
+
+			if (last)
+				break;
+
+			buf.erase(0, in.data - &buf[0]); // what's left over goes first
+		}
+
+		n = news - n;
+		bytes = new_bytes - bytes;
+
+		check(data >= size / 2 && meta.size() && self.size(), "payload: fields not read");
+		check(n <= 4 && bytes <= 2 * (meta.capacity() + self.capacity()),
+			stringf("payload: %zu allocations, %zu bytes for a %zu byte body", n, bytes, body.size()).c_str());
+	}
+}
+
+static bool run_checks()
+{
+	check_to_uint();
+	check_find();
+	check_skip_string();
+	check_board_scan();
+	check_arena();
+	check_no_clen();
+	check_payload_allocs();
+	check_routes();
+
+	if (failed)
+		fprintf(stderr, "%d checks failed\n", failed);
+
+	return ! failed;
+}
+
+/*
+ *	the benchmarks
+ */
+static void bench_corpus(vector<result> & out, const options & opt, const corpus & c)
+{
+	string raw  = c.raw;   // mutable copies for ch_range
+	string body = c.body;
+	string head = c.raw.substr(0, c.head);
+	string data = c.data;
+	string work;
+
+	ch_range body_r(body);
+	ch_range head_r(head);
+
+	// ch_range
+
+	run(out, opt, "ch_range/find_char", c, body.size(), [&]{
+		sink += (size_t)body_r.find('\x01'); // not there, scans it all
+	});
+
+	run(out, opt, "ch_range/find_str", c, body.size(), [&]{
+		sink += (size_t)body_r.find(ch_range((char*)"&SELF="));
+	});
+
+	// find() variants, same scans as above
+
+	typedef char * (* find_char_fn)(const char *, size_t, char);
+	typedef char * (* find_str_fn)(const char *, size_t, const char *, size_t);
+
+	struct { const char * name; bool ok; find_char_fn fc; find_str_fn fs; } finds[] =
+	{
+		{ "scalar", true,           ch_find_char_scalar, ch_find_str_scalar },
+		{ "sse2",   cpu_has_sse2(), ch_find_char_sse2,   ch_find_str_sse2   },
+		{ "avx2",   cpu_has_avx2(), ch_find_char_avx2,   ch_find_str_avx2   },
+	};
+
+	for (auto & f : finds)
+	{
+		if (! f.ok)
+			continue;
+
+		run(out, opt, stringf("ch_range/find_char_%s", f.name), c, body.size(), [&]{
+			sink += (size_t)f.fc(body.data(), body.size(), '\x01');
+		});
+
+		run(out, opt, stringf("ch_range/find_str_%s", f.name), c, body.size(), [&]{
+			sink += (size_t)f.fs(body.data(), body.size(), "&SELF=", 6);
+		});
+	}
+
+	run(out, opt, "ch_range/tokens", c, head.size(), [&]{
+		size_t n = 0;
+		for (auto & line : head_r.tokens("\r\n", true))
+			n += line.size;
+		sink += n;
+	});
+
+	run(out, opt, "ch_range/tokenize", c, head.size(), [&]{
+		ch_range_vec lines;
+		head_r.tokenize("\r\n", lines, true);
+		sink += lines.size();
+	});
+
+	run(out, opt, "ch_range/split", c, body.size(), [&]{
+		ch_range rest = body_r, field, key, val;
+		size_t n = 0;
+
+		while (rest.size)
+		{
+			field = rest;
+			if (! field.split_with("&", rest))
+				rest = ch_range();
+
+			if (field.split("=", key, val))
+				n += val.size;
+		}
+
+		sink += n;
+	});
+
+	run(out, opt, "ch_range/match", c, head.size(), [&]{
+		ch_range rest = head_r, line;
+		size_t n = 0;
+
+		while (rest.get_line(line))
+		{
+			ch_range name, value;
+
+			if (line.split(":", name, value))
+				n += name.match("content-length") + name.match("x-access-token") + name.match("connection");
+		}
+
+		sink += n;
+	});
+
+	// the request
+
+	run(out, opt, "http/parse_request", c, c.head, [&]{
+		sk_conn  conn;
+		http_req req;
+
+		conn.buf.ptr = &raw[0];
+		conn.buf.cap = raw.size();
+		conn.fill = raw.size();
+
+		sink += parse_http_request(conn, req);
+
+		conn.buf.ptr = NULL; // not from sk_bufs
+	});
+
+	run(out, opt, "http/form_reader", c, body.size(), [&]{
+		ch_range in, piece;
+		form_reader form;
+		size_t n = 0;
+
+		work = c.body;
+		in = ch_range(work);
+
+		while (form.next(in, true, piece))
+			n += piece.size;
+
+		sink += n;
+	});
+
+	// percent_decode and its variants, copying the input is a part of it
+
+	run(out, opt, "http/memcpy_baseline", c, body.size(), [&]{
+		work = c.body;
+		sink += work.size();
+	});
+
+	run(out, opt, "http/percent_decode", c, body.size(), [&]{
+		work = c.body;
+		sink += percent_decode(&work[0], work.size());
+	});
+
+	run(out, opt, "http/percent_decode_scalar", c, body.size(), [&]{
+		work = c.body;
+		sink += percent_decode_scalar(&work[0], work.size());
+	});
+
+	if (cpu_has_avx2())
+		run(out, opt, "http/percent_decode_avx2", c, body.size(), [&]{
+			work = c.body;
+			sink += percent_decode_avx2(&work[0], work.size());
+		});
+
+	// the board
+
+	if (data.empty())
+		return;
+
+	{
+		board_scan scan;
+
+		if (! scan.feed(ch_range(data)) || ! scan.finish())
+			fprintf(stderr, "%s: malformed board data - %s\n", c.name.c_str(), scan.error);
+	}
+
+	run(out, opt, "board/scan", c, data.size(), [&]{
+		board_scan scan;
+
+		scan.feed(ch_range(data));
+		scan.finish();
+		sink += (size_t)scan.revision.val;
+	});
+
+	run(out, opt, "board/scan_4k_pieces", c, data.size(), [&]{
+		board_scan scan;
+
+		for (size_t at = 0; at < data.size(); at += 4096)
+			scan.feed(ch_range(&data[at], std::min((size_t)4096, data.size() - at)));
+
+		scan.finish();
+		sink += (size_t)scan.revision.val;
+	});
+}
+
+// Content-Length values and board ids, as parsed off each request
+static void bench_numbers(vector<result> & out, const options & opt)
+{
+	vector<string> nums;
+	corpus c;
+	size_t bytes = 0;
+	rng    r(2);
+
+	c.name = "numbers";
+
+	for (int i=0; i<1000; i++)
+	{
+		nums.push_back( (i & 1) ? stringf("%zu", r.below(2*1024*1024)) : stringf("%llu", 1600000000000ull + r.below(100000000000ull)) );
+		bytes += nums.back().size();
+	}
+
+	run(out, opt, "num/to_u64", c, bytes, [&]{
+		uint64_t v, n = 0;
+
+		for (auto & x : nums)
+			if (ch_range((char*)x.data(), x.size()).to_u64(v))
+				n += v;
+
+		sink += n;
+	});
+
+	run(out, opt, "num/sscanf", c, bytes, [&]{
+		unsigned long long v, n = 0;
+		int end;
+
+		// what the engine did before to_u64(), the %n is for the trailing junk check
+		for (auto & x : nums)
+			if (sscanf(x.c_str(), "%llu%n", &v, &end) == 1 && end == (int)x.size())
+				n += v;
+
+		sink += n;
+	});
+}
+
+// a request line's verb and path to the route, an op is one lookup
+static void bench_routes(vector<result> & out, const options & opt)
+{
+	struct { const char * name; int verb; string path; } reqs[] =
+	{
+		{ "route/put_test",        vb_put,    "/test"                },
+		{ "route/put_config",      vb_put,    "/config"              },
+		{ "route/put_board",       vb_put,    "/board/1618261845169" },
+		{ "route/del_board",       vb_delete, "/board/1618261845169" },
+		{ "route/get_metrics",     vb_get,    "/metrics"             },
+		{ "route/get_spans",       vb_get,    "/spans"               },
+		{ "route/404_verb",        vb_get,    "/board/1618261845169" },
+		{ "route/404_letter",      vb_put,    "/favicon.ico"         },
+		{ "route/404_prefix",      vb_put,    "/boards/1618261845169"},
+		{ "route/404_id",          vb_put,    "/board/1618261845169x"},
+		{ "route/404_long",        vb_put,    "/board/" + string(4096, '7') },
+	};
+	corpus c;
+
+	c.name = "routes";
+
+	for (auto & r : reqs)
+	{
+		ch_range path(r.path);
+
+		run(out, opt, r.name, c, r.path.size(), [&]{
+			ch_range id;
+			sink += find_route(r.verb, path, id) + id.size;
+		});
+	}
+}
+
+/*
+ *	Tracing, through the real tracer to /dev/null, at each trace
+ *	level with the call sites compiled in and with them compiled
+ *	out by TRACE_MAX. An op is the traces of a parsed request -
+ *	one info, six verbose and two debug ones.
+ */
+#undef  TRACE_MAX
+#define TRACE_MAX  4
+
+static void traced_in(const corpus & c, size_t i)
+{
+	trace_i("Parsed as [PUT] [/board/%zu] [HTTP/1.1]\n", i);
+	trace_v("Header break @ %zu\n", c.head - 4);
+	trace_v("req_line [%s]\n", "PUT /board/1618261845169 HTTP/1.1");
+	trace_v("header   [%-30s] [%zu]\n", "Content-Length", c.body.size());
+	trace_v("header   [%-30s] [%s]\n", "X-Access-Token", "9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e");
+	trace_v("header   [%-30s] [%s]\n", "Content-Type", "application/x-www-form-urlencoded");
+	trace_v("URI = [/board/%zu] [] []\n", i);
+	trace_d("%zu bytes in, %zu to go\n", c.head, c.body.size());
+	trace_d("Payload complete, %zu bytes\n", c.body.size());
+}
+
+#undef  TRACE_MAX
+#define TRACE_MAX  1
+
+static void traced_out(const corpus & c, size_t i)
+{
+	trace_i("Parsed as [PUT] [/board/%zu] [HTTP/1.1]\n", i);
+	trace_v("Header break @ %zu\n", c.head - 4);
+	trace_v("req_line [%s]\n", "PUT /board/1618261845169 HTTP/1.1");
+	trace_v("header   [%-30s] [%zu]\n", "Content-Length", c.body.size());
+	trace_v("header   [%-30s] [%s]\n", "X-Access-Token", "9b4f2c8e1d7a6b3f5c0e9d8a7b6c5d4e");
+	trace_v("header   [%-30s] [%s]\n", "Content-Type", "application/x-www-form-urlencoded");
+	trace_v("URI = [/board/%zu] [] []\n", i);
+	trace_d("%zu bytes in, %zu to go\n", c.head, c.body.size());
+	trace_d("Payload complete, %zu bytes\n", c.body.size());
+}
+
+#undef  TRACE_MAX
+#define TRACE_MAX  4
+
+static void bench_trace(vector<result> & out, const options & opt, const corpus & req)
+{
+	corpus c;
+	size_t i = 0;
+
+	for (uint_t level = 0; level <= 4; level++)
+	{
+		conf.trace = level;
+
+		c.name = "compiled_in";
+		run(out, opt, stringf("trace/level_%u", level), c, 0, [&]{ traced_in(req, i++); });
+
+		c.name = "compiled_out";
+		run(out, opt, stringf("trace/level_%u", level), c, 0, [&]{ traced_out(req, i++); });
+	}
+
+	conf.trace = 0;
+}
+
+/*
+ *	output
+ */
+static void print_json(const vector<result> & res)
+{
+	printf("{\n");
+	printf("  \"version\": 1,\n");
+	printf("  \"cpu\": { \"sse2\": %s, \"avx2\": %s },\n", cpu_has_sse2() ? "true" : "false", cpu_has_avx2() ? "true" : "false");
+	printf("  \"results\": [\n");
+
+	for (size_t i=0; i<res.size(); i++)
+	{
+		const result & r = res[i];
+
+		printf("    { \"name\": \"%s\", \"corpus\": \"%s\", \"bytes\": %zu, \"ns_per_op\": %.1f, \"mb_per_s\": %.1f }%s\n",
+			r.name.c_str(), r.corpus.c_str(), r.bytes, r.ns,
+			r.ns > 0 ? r.bytes * 1e3 / r.ns : 0., (i + 1 < res.size()) ? "," : "");
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+}
+
+static int syntax()
+{
+	fprintf(stderr,
+		"Syntax: nb-bench [-c <dir> | -p <capture>] [-f <filter>] [-t <ms>] [-r <reps>]\n"
+		"\n"
+		"  -c  folder with raw requests in *.http files, made up if not set\n"
+		"  -p  or a capture file, made with -t, the largest requests in it are used\n"
+		"  -f  run only the benchmarks with this in their name\n"
+		"  -t  minimum time per rep, in ms, default 100\n"
+		"  -r  reps per benchmark, the median is reported, default 5\n");
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	options        opt;
+	vector<corpus> corpora;
+	vector<result> res;
+
+	for (int i=1; i<argc; i++)
+	{
+		string a = argv[i];
+
+		if (i + 1 == argc)
+			return syntax();
+
+		if (a == "-c") opt.dir    = argv[++i];       else
+		if (a == "-p") opt.capture = argv[++i];      else
+		if (a == "-f") opt.filter = argv[++i];       else
+		if (a == "-t") opt.min_ms = atof(argv[++i]); else
+		if (a == "-r") opt.reps   = atoi(argv[++i]); else
+			return syntax();
+	}
+
+	if (opt.min_ms <= 0 || opt.reps < 1)
+		return syntax();
+
+	if (opt.dir.size() && opt.capture.size())
+		return syntax();
+
+	if (opt.dir.size())
+	{
+		if (! load_corpora(opt.dir, corpora))
+			return 2;
+	}
+	else
+	if (opt.capture.size())
+	{
+		if (! load_captured(opt.capture, corpora))
+			return 2;
+	}
+	else
+		make_corpora(corpora);
+
+	// traces go nowhere, and only the errors at that
+
+	conf.trace = 0;
+	conf.trace_file = L"/dev/null";
+
+	if (! start_tracer())
+		return 2;
+
+	if (! run_checks())
+	{
+		stop_tracer();
+		return 3;
+	}
+
+	for (auto & c : corpora)
+		bench_corpus(res, opt, c);
+
+	bench_numbers(res, opt);
+	bench_routes(res, opt);
+	bench_trace(res, opt, corpora[0]);
+
+	stop_tracer();
+
+	print_json(res);
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "boards.h"
+#include "utils.h"
+
+//
+static string make_text(rng & r, size_t len)
+{
+	static const char * words[] =
+	{
+		"call", "Alice", "re:", "budget", "draft", "review", "ship", "v2.1",
+		"fix", "the", "login", "bug", "(urgent)", "TODO", "notes", "meeting",
+		"email", "Bob", "about", "Q3", "plan", "\\\"quoted\\\"", "caf\\u00e9", "\\n",
+		"100%", "&", "a+b", "done", "#tag", "->", "https://example.com/x?y=1",
+	};
+
+	string s;
+
+	while (s.size() < len)
+	{
+		if (s.size())
+			s += ' ';
+
+		s += words[r.below(sizeof words / sizeof *words)];
+	}
+
+	return s;
+}
+
+string make_board(size_t size, uint64_t id, uint32_t rev)
+{
+	rng    r(id ^ size);
+	string s;
+	int    lists = 0;
+
+	s = stringf("{\"format\":20190412,\"id\":%llu,\"revision\":%u,\"title\":\"Board %u\",\"lists\":[",
+		(unsigned long long)id, rev, (uint_t)(size / 1024));
+
+	while (s.size() < size)
+	{
+		int notes = 3 + (int)r.below(12);
+
+		s += stringf("%s{\"title\":\"%s\",\"notes\":[", lists++ ? "," : "", make_text(r, 8 + r.below(16)).c_str());
+
+		for (int i=0; i<notes; i++)
+			s += stringf("%s{\"text\":\"%s\",\"raw\":%s,\"min\":%s}", i ? "," : "",
+				make_text(r, 10 + r.below(r.below(8) ? 80 : 600)).c_str(),
+				r.below(5) ? "false" : "true", r.below(7) ? "false" : "true");
+
+		s += "]}";
+	}
+
+	s += "]}";
+	return s;
+}
+
+string url_encode(const string & in)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	string out;
+
+	for (uint8_t ch : in)
+	{
+		if (('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ('0' <= ch && ch <= '9') || strchr("-_.!~*'()", ch))
+		{
+			out += (char)ch;
+			continue;
+		}
+
+		out += '%';
+		out += hex[ch >> 4];
+		out += hex[ch & 15];
+	}
+
+	return out;
+}
+
+string board_form(const string & data, uint32_t rev)
+{
+	string meta;
+
+	meta = stringf("{\"title\":\"Board\",\"current\":%u,\"ui_spot\":0,\"history\":[%u,%u,%u],\"backups\":[]}", rev, rev, rev-1, rev-2);
+
+	return "data=" + url_encode(data) + "&meta=" + url_encode(meta) + "&self=" + url_encode("{\"url\":\"file:///C:/nullboard/nullboard.html\"}");
+}
+
+string board_request(const string & data, uint64_t id, uint32_t rev, const char * token)
+{
+	string body, head;
+
+	body = board_form(data, rev);
+
+	head = stringf(
+		"PUT /board/%llu HTTP/1.1\r\n"
+		"Host: 127.0.0.1:10001\r\n"
+		"Connection: keep-alive\r\n"
+		"Content-Length: %zu\r\n"
+		"sec-ch-ua: \"Chromium\";v=\"112\", \"Google Chrome\";v=\"112\", \"Not:A-Brand\";v=\"99\"\r\n"
+		"X-Access-Token: %s\r\n"
+		"sec-ch-ua-mobile: ?0\r\n"
+		"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/112.0.0.0 Safari/537.36\r\n"
+		"Content-Type: application/x-www-form-urlencoded; charset=UTF-8\r\n"
+		"Accept: */*\r\n"
+		"Origin: null\r\n"
+		"Sec-Fetch-Site: cross-site\r\n"
+		"Sec-Fetch-Mode: cors\r\n"
+		"Sec-Fetch-Dest: empty\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Accept-Language: en-US,en;q=0.9\r\n"
+		"\r\n", (unsigned long long)id, body.size(), token);
+
+	return head + body;
+}
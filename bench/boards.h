@@ -0,0 +1,34 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BENCH_BOARDS_H_
+#define _BENCH_BOARDS_H_
+
+#include "types.h"
+
+/*
+ *	Made up Nullboard boards and the requests that save them,
+ *	shaped like what the app sends. The same arguments always
+ *	give the same output.
+ */
+struct rng // xorshift
+{
+	uint64_t s;
+
+	rng(uint64_t seed) { s = seed ? seed : 1; }
+	uint64_t next() { s ^= s << 13; s ^= s >> 7; s ^= s << 17; return s; }
+	size_t   below(size_t n) { return (size_t)(next() % n); }
+};
+
+string make_board(size_t size, uint64_t id, uint32_t rev); // JSON, about 'size' bytes
+string url_encode(const string & in);                      // as encodeURIComponent()
+
+string board_form(const string & data, uint32_t rev);      // data=...&meta=...&self=...
+string board_request(const string & data, uint64_t id, uint32_t rev, const char * token);
+
+#endif
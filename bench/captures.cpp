@@ -0,0 +1,54 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "captures.h"
+
+//
+bool load_capture(const string & file, string & data)
+{
+	FILE * f = fopen(file.c_str(), "rb");
+	char   buf[64*1024];
+	size_t got;
+
+	if (! f)
+	{
+		fprintf(stderr, "Can't open %s\n", file.c_str());
+		return false;
+	}
+
+	while ((got = fread(buf, 1, sizeof buf, f)))
+		data.append(buf, got);
+
+	fclose(f);
+
+	const cap_header * h = (const cap_header *)data.data();
+
+	if (data.size() < sizeof *h ||
+	    memcmp(h->magic, "nb-captr", 8) || h->version != 1 || h->rec_size != sizeof(cap_record))
+	{
+		fprintf(stderr, "%s is not a capture or it's of an unknown version\n", file.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool cap_reader::next(cap_record & r, const char * & p)
+{
+	if (at + sizeof r > data.size())
+		return false;
+
+	memcpy(&r, data.data() + at, sizeof r);
+
+	if (r.len > data.size() - at - sizeof r)
+		return false;
+
+	p = data.data() + at + sizeof r;
+	at += sizeof r + r.len;
+	return true;
+}
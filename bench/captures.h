@@ -0,0 +1,32 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BENCH_CAPTURES_H_
+#define _BENCH_CAPTURES_H_
+
+#include "capture.h"
+
+/*
+ *	Capture files, as written with "-t <file>", read back in
+ */
+bool load_capture(const string & file, string & data); // whole, with the header checked
+
+struct cap_reader
+{
+	cap_reader(const string & _data) : data(_data) { at = sizeof(cap_header); }
+
+	// false at the end or where the capture is cut short
+	bool next(cap_record & r, const char * & p);
+
+	bool cut_short() const { return at != data.size(); }
+
+	const string & data;
+	size_t         at;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+#
+#	Compares two nb-bench runs and flags the benchmarks that got
+#	slower by more than the threshold. Exits with 1 if any did.
+#
+#	compare.py base.json new.json [--threshold 10]
+#
+import argparse
+import json
+import sys
+
+def load(path):
+	with open(path) as f:
+		doc = json.load(f)
+
+	return { (r['name'], r['corpus']): r for r in doc['results'] }
+
+def main():
+	ap = argparse.ArgumentParser(description='Compare two nb-bench runs')
+	ap.add_argument('base')
+	ap.add_argument('new')
+	ap.add_argument('--threshold', type=float, default=10., help='percent, default 10')
+	args = ap.parse_args()
+
+	base = load(args.base)
+	new  = load(args.new)
+	bad  = 0
+
+	print('%-32s %-16s %14s %14s %8s' % ('benchmark', 'corpus', 'base ns', 'new ns', 'delta'))
+
+	for key in base:
+		if key not in new:
+			print('%-32s %-16s %14.1f %14s %8s' % (key[0], key[1], base[key]['ns_per_op'], '-', 'gone'))
+			continue
+
+		b = base[key]['ns_per_op']
+		n = new[key]['ns_per_op']
+		d = (n - b) * 100. / b if b else 0.
+		flag = ''
+
+		if d > args.threshold:
+			flag = '  << slower'
+			bad += 1
+
+		print('%-32s %-16s %14.1f %14.1f %+7.1f%%%s' % (key[0], key[1], b, n, d, flag))
+
+	for key in new:
+		if key not in base:
+			print('%-32s %-16s %14s %14.1f %8s' % (key[0], key[1], '-', new[key]['ns_per_op'], 'new'))
+
+	if bad:
+		print('\n%d benchmark(s) slower by more than %g%%' % (bad, args.threshold))
+		return 1
+
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,583 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "boards.h"
+#include "utils.h"
+#include "config.h"
+#include "console.h"
+#include "engine.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <netdb.h>
+#include <ftw.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+/*
+ *	Load generator for a running agent. Each client keeps a
+ *	connection open and saves its board the way Nullboard does -
+ *	an OPTIONS preflight followed by PUT /board/<id> with the next
+ *	revision - and now and then deletes the board and moves on to
+ *	a new one.
+ *
+ *	Saves are started on a fixed schedule when a rate is given and
+ *	a save's latency, preflight included, is counted from when it
+ *	was due rather than from when it was sent, so a stalled agent
+ *	shows up in the tail instead of just slowing the clients down.
+ *	The latency of the individual requests is from their sending.
+ */
+typedef std::chrono::steady_clock lg_clock;
+
+struct lg_options
+{
+	string    host;
+	uint16_t  port;
+	string    token;
+	int       clients;
+	double    seconds;
+	vector<size_t> sizes;  // of the boards, picked round-robin by clients
+	double    rate;        // saves per second per client, 0 for back to back
+	int       deletes;     // percent of saves followed by a delete
+	int       timeout_ms;
+	bool      in_process;  // -i, runs the agent's engine on a thread of its own
+
+	lg_options() { host = "127.0.0.1"; port = 10001; clients = 8; seconds = 10; rate = 0; deletes = 5; timeout_ms = 5000; in_process = false; }
+};
+
+enum
+{
+	op_options,
+	op_put,
+	op_delete,
+	op_save,      // OPTIONS + PUT, from when it was due
+	op_count
+};
+
+static const char * op_names[op_count] = { "OPTIONS", "PUT", "DELETE", "save" };
+
+struct lg_stats
+{
+	vector<uint32_t>  usec[op_count];  // latencies
+	uint64_t          errors[op_count];
+	uint64_t          connects;
+	uint64_t          connect_errors;
+	uint64_t          bytes_out;
+
+	lg_stats() { memset(errors, 0, sizeof errors); connects = 0; connect_errors = 0; bytes_out = 0; }
+};
+
+static std::atomic<bool> stop_all(false);
+
+/*
+ *	a connection
+ */
+struct lg_conn
+{
+	int     sk;
+	string  in;    // received, not yet consumed
+
+	lg_conn() { sk = -1; }
+	~lg_conn() { close(); }
+
+	void close() { if (sk != -1) ::close(sk); sk = -1; in.clear(); }
+};
+
+static bool lg_connect(lg_conn & c, const lg_options & opt, lg_stats & st)
+{
+	sockaddr_in sa = { };
+	int yes = 1;
+
+	c.close();
+
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(opt.port);
+
+	if (inet_pton(AF_INET, opt.host.c_str(), &sa.sin_addr) != 1)
+	{
+		addrinfo hints = { }, * res;
+
+		hints.ai_family = AF_INET;
+
+		if (getaddrinfo(opt.host.c_str(), NULL, &hints, &res) != 0)
+		{
+			st.connect_errors++;
+			return false;
+		}
+
+		sa.sin_addr = ((sockaddr_in*)res->ai_addr)->sin_addr;
+		freeaddrinfo(res);
+	}
+
+	c.sk = socket(AF_INET, SOCK_STREAM, 0);
+	if (c.sk < 0)
+	{
+		st.connect_errors++;
+		return false;
+	}
+
+	setsockopt(c.sk, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+
+	if (connect(c.sk, (sockaddr*)&sa, sizeof sa) < 0)
+	{
+		c.close();
+		st.connect_errors++;
+		return false;
+	}
+
+	st.connects++;
+	return true;
+}
+
+static bool send_all(lg_conn & c, const string & data)
+{
+	size_t done = 0;
+
+	while (done < data.size())
+	{
+		ssize_t n = send(c.sk, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+
+		if (n <= 0)
+			return false;
+
+		done += n;
+	}
+
+	return true;
+}
+
+static bool recv_some(lg_conn & c, int timeout_ms)
+{
+	pollfd pf = { c.sk, POLLIN, 0 };
+	char   buf[16*1024];
+	ssize_t n;
+
+	if (poll(&pf, 1, timeout_ms) <= 0)
+		return false;
+
+	n = recv(c.sk, buf, sizeof buf, 0);
+	if (n <= 0)
+		return false;
+
+	c.in.append(buf, n);
+	return true;
+}
+
+/*
+ *	Reads a response, returns its status or -1. 'keep' is set to
+ *	false if the agent is closing the connection.
+ */
+static int read_response(lg_conn & c, const lg_options & opt, bool & keep)
+{
+	size_t end, clen = 0;
+	int    status;
+	string head;
+
+	while ((end = c.in.find("\r\n\r\n")) == string::npos)
+		if (! recv_some(c, opt.timeout_ms))
+			return -1;
+
+	head = c.in.substr(0, end + 2);
+
+	if (sscanf(head.c_str(), "HTTP/1.%*d %d", &status) != 1)
+		return -1;
+
+	keep = true;
+
+	for (size_t at = head.find("\r\n") + 2; at < head.size(); )
+	{
+		size_t eol = head.find("\r\n", at);
+		string line = head.substr(at, eol - at);
+
+		if (! strncasecmp(line.c_str(), "content-length:", 15))
+			clen = strtoul(line.c_str() + 15, NULL, 10);
+
+		if (! strncasecmp(line.c_str(), "connection:", 11) && strcasestr(line.c_str(), "close"))
+			keep = false;
+
+		at = eol + 2;
+	}
+
+	end += 4;
+
+	while (c.in.size() < end + clen)
+		if (! recv_some(c, opt.timeout_ms))
+			return -1;
+
+	c.in.erase(0, end + clen);
+	return status;
+}
+
+static void add_usec(lg_stats & st, int op, lg_clock::time_point since)
+{
+	st.usec[op].push_back((uint32_t)std::min<int64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(lg_clock::now() - since).count(), UINT32_MAX));
+}
+
+/*
+ *	Sends a request and reads the reply, reconnecting first if
+ *	needed
+ */
+static bool do_op(lg_conn & c, const lg_options & opt, lg_stats & st, int op, const string & req)
+{
+	auto t0 = lg_clock::now();
+	bool keep = false;
+	int  status;
+
+	if (c.sk == -1 && ! lg_connect(c, opt, st))
+	{
+		st.errors[op]++;
+		return false;
+	}
+
+	if (! send_all(c, req))
+	{
+		// the agent may've closed an idle connection, one retry
+
+		if (! lg_connect(c, opt, st) || ! send_all(c, req))
+		{
+			c.close();
+			st.errors[op]++;
+			return false;
+		}
+	}
+
+	st.bytes_out += req.size();
+
+	status = read_response(c, opt, keep);
+
+	if (status < 200 || status > 299)
+	{
+		c.close();
+		st.errors[op]++;
+		return false;
+	}
+
+	if (! keep)
+		c.close();
+
+	add_usec(st, op, t0);
+	return true;
+}
+
+static string options_request(uint64_t id)
+{
+	return stringf(
+		"OPTIONS /board/%llu HTTP/1.1\r\n"
+		"Host: 127.0.0.1:10001\r\n"
+		"Connection: keep-alive\r\n"
+		"Accept: */*\r\n"
+		"Access-Control-Request-Method: PUT\r\n"
+		"Access-Control-Request-Headers: x-access-token\r\n"
+		"Origin: null\r\n"
+		"Sec-Fetch-Mode: cors\r\n"
+		"\r\n", (unsigned long long)id);
+}
+
+static string delete_request(uint64_t id, const string & token)
+{
+	return stringf(
+		"DELETE /board/%llu HTTP/1.1\r\n"
+		"Host: 127.0.0.1:10001\r\n"
+		"Connection: keep-alive\r\n"
+		"X-Access-Token: %s\r\n"
+		"Origin: null\r\n"
+		"\r\n", (unsigned long long)id, token.c_str());
+}
+
+static void client(int n, const lg_options & opt, lg_stats & st)
+{
+	rng      r(0x5eed + n);
+	lg_conn  c;
+	size_t   size = opt.sizes[n % opt.sizes.size()];
+	uint64_t id   = 1600000000000ull + (uint64_t)n * 1000000;
+	uint32_t rev  = 1;
+	string   data;
+	auto     start = lg_clock::now();
+	auto     due   = start;
+	auto     step  = std::chrono::duration_cast<lg_clock::duration>(std::chrono::duration<double>(opt.rate > 0 ? 1. / opt.rate : 0.));
+
+	// the board changes a bit with each save, the size doesn't
+
+	data = make_board(size, id, rev);
+
+	while (! stop_all)
+	{
+		if (opt.rate > 0)
+		{
+			due += step;
+			std::this_thread::sleep_until(due);
+
+			if (stop_all)
+				break;
+		}
+		else
+		{
+			due = lg_clock::now();
+		}
+
+		if (do_op(c, opt, st, op_options, options_request(id)) &&
+		    do_op(c, opt, st, op_put, board_request(data, id, rev, opt.token.c_str())))
+		{
+			add_usec(st, op_save, due);
+			rev++;
+		}
+
+		if ((int)r.below(100) < opt.deletes)
+		{
+			do_op(c, opt, st, op_delete, delete_request(id, opt.token));
+
+			id++;
+			rev = 1;
+			data = make_board(size, id, rev);
+		}
+		else
+		{
+			// a keystroke's worth of change to the revision field
+
+			size_t at = data.find("\"revision\":");
+			size_t to = data.find(',', at);
+
+			data.replace(at, to - at, stringf("\"revision\":%u", rev));
+		}
+	}
+}
+
+/*
+ *	the report
+ */
+static uint32_t pct(const vector<uint32_t> & v, double p) // v is sorted
+{
+	if (v.empty())
+		return 0;
+
+	size_t i = (size_t)(p / 100 * (v.size() - 1) + .5);
+	return v[std::min(i, v.size() - 1)];
+}
+
+static void report(const lg_options & opt, lg_stats & all, double secs)
+{
+	uint64_t total = 0, errors = 0;
+
+	printf("%d client(s), %.1f s, boards of", opt.clients, secs);
+	for (auto s : opt.sizes)
+		printf(" %zuK", s / 1024);
+	printf(", %s\n\n", opt.rate > 0 ? stringf("%g saves/s per client", opt.rate).c_str() : "back to back");
+
+	printf("%-8s %10s %10s %8s %10s %10s %10s %10s\n", "", "requests", "per sec", "errors", "p50 us", "p99 us", "p999 us", "max us");
+
+	for (int op=0; op<op_count; op++)
+	{
+		auto & v = all.usec[op];
+
+		std::sort(v.begin(), v.end());
+
+		printf("%-8s %10zu %10.1f %8llu %10u %10u %10u %10u\n", op_names[op],
+			v.size(), v.size() / secs, (unsigned long long)all.errors[op],
+			pct(v, 50), pct(v, 99), pct(v, 99.9), v.empty() ? 0 : v.back());
+
+		if (op == op_save)
+			continue; // already counted as requests
+
+		total  += v.size();
+		errors += all.errors[op];
+	}
+
+	printf("\n%llu request(s), %.1f per sec, %llu error(s), %.1f MB/s sent, %llu connect(s), %llu failed\n",
+		(unsigned long long)total, total / secs, (unsigned long long)errors,
+		all.bytes_out / secs / 1e6, (unsigned long long)all.connects, (unsigned long long)all.connect_errors);
+}
+
+/*
+ *	In-process mode, -i. The engine is built over the shims in
+ *	win32/ and serves a single area for the clients' token from a
+ *	scratch folder, which is removed once the engine is stopped.
+ *	The UI's side of the engine is a no-op.
+ */
+void show_console(bool) { }
+void on_engine_activity() { }
+
+static string agent_path;
+
+static bool start_agent(const lg_options & opt)
+{
+	char    tmp[] = "/tmp/nb-loadgen-XXXXXX";
+	in_addr addr;
+
+	if (inet_pton(AF_INET, opt.host.c_str(), &addr) != 1)
+		return false;
+
+	if (! mkdtemp(tmp))
+	{
+		fprintf(stderr, "mkdtemp() failed with %d\n", errno);
+		return false;
+	}
+
+	agent_path = tmp;
+
+	conf.path = to_wstr(tmp);
+	conf.addr = ntohl(addr.s_addr);
+	conf.port = opt.port;
+	conf.trace = 0;        // errors only
+	conf.say_hello = false;
+	conf.event_log = 0;
+
+	add_area(opt.token, area_info{ L"loadgen", L"", 0 });
+
+	if (! make_path(conf.path + L"\\loadgen") || ! start_tracer())
+		return false;
+
+	if (! init_engine())
+	{
+		stop_tracer();
+		return false;
+	}
+
+	start_engine();
+	return true;
+}
+
+static int remove_one(const char * path, const struct stat *, int, FTW *)
+{
+	return remove(path);
+}
+
+static void stop_agent()
+{
+	stop_engine();
+	stop_tracer();
+
+	nftw(agent_path.c_str(), remove_one, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int syntax()
+{
+	fprintf(stderr,
+		"Syntax: nb-loadgen -k <token> [-a <host:port>] [-c <clients>] [-t <seconds>]\n"
+		"                   [-s <size,...>] [-r <saves/s>] [-x <delete %%>]\n"
+		"       nb-loadgen -i [-a <host:port>] ...\n"
+		"\n"
+		"  -k  access token of an area set up in the agent\n"
+		"  -a  the agent, default 127.0.0.1:10001\n"
+		"  -i  run the agent in-process, on a scratch folder in /tmp\n"
+		"  -c  concurrent clients, default 8\n"
+		"  -t  how long to run, default 10\n"
+		"  -s  board sizes in KB, spread over the clients, default 16\n"
+		"  -r  saves per second per client, default 0 - back to back\n"
+		"  -x  percent of saves followed by a delete, default 5\n");
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	lg_options       opt;
+	vector<lg_stats> stats;
+	vector<std::thread> threads;
+	lg_stats         all;
+
+	for (int i=1; i<argc; i++)
+	{
+		string a = argv[i];
+		string v;
+
+		if (a == "-i")
+		{
+			opt.in_process = true;
+			continue;
+		}
+
+		if (i + 1 == argc)
+			return syntax();
+
+		v = argv[++i];
+
+		if (a == "-k") opt.token   = v;                 else
+		if (a == "-c") opt.clients = atoi(v.c_str());   else
+		if (a == "-t") opt.seconds = atof(v.c_str());   else
+		if (a == "-r") opt.rate    = atof(v.c_str());   else
+		if (a == "-x") opt.deletes = atoi(v.c_str());   else
+		if (a == "-a")
+		{
+			size_t colon = v.rfind(':');
+
+			opt.host = v.substr(0, colon);
+			if (colon != string::npos)
+				opt.port = (uint16_t)atoi(v.c_str() + colon + 1);
+		}
+		else
+		if (a == "-s")
+		{
+			for (char * p = &v[0]; *p; )
+			{
+				opt.sizes.push_back(strtoul(p, &p, 10) * 1024);
+				if (*p) p++;
+			}
+		}
+		else
+			return syntax();
+	}
+
+	if (opt.sizes.empty())
+		opt.sizes.push_back(16*1024);
+
+	if (opt.in_process && opt.token.empty())
+		opt.token = "loadgen";
+
+	if (opt.token.empty() || opt.clients < 1 || opt.seconds <= 0 || opt.rate < 0)
+		return syntax();
+
+	for (auto s : opt.sizes)
+		if (! s)
+			return syntax();
+
+	if (opt.in_process && ! start_agent(opt))
+	{
+		fprintf(stderr, "Failed to start the agent on %s:%u\n", opt.host.c_str(), opt.port);
+		return 2;
+	}
+
+	//
+	stats.resize(opt.clients);
+
+	auto t0 = lg_clock::now();
+
+	for (int i=0; i<opt.clients; i++)
+		threads.emplace_back(client, i, std::cref(opt), std::ref(stats[i]));
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+	stop_all = true;
+
+	for (auto & t : threads)
+		t.join();
+
+	double secs = std::chrono::duration<double>(lg_clock::now() - t0).count();
+
+	if (opt.in_process)
+		stop_agent();
+
+	for (auto & st : stats)
+	{
+		for (int op=0; op<op_count; op++)
+		{
+			all.usec[op].insert(all.usec[op].end(), st.usec[op].begin(), st.usec[op].end());
+			all.errors[op] += st.errors[op];
+		}
+
+		all.connects       += st.connects;
+		all.connect_errors += st.connect_errors;
+		all.bytes_out      += st.bytes_out;
+	}
+
+	report(opt, all, secs);
+	return 0;
+}
@@ -0,0 +1,508 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "captures.h"
+#include "utils.h"
+
+#include <map>
+#include <set>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+
+#include <netdb.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+/*
+ *	Replays a capture made with "-t <file>" against a running
+ *	agent. The requests go out over as many connections as there
+ *	were originally and in the same order, byte for byte as they
+ *	were read, either at the original pace or back to back.
+ *
+ *	The latency of a request is from when it's been sent in full
+ *	till its reply is read in full. Replies are matched to the
+ *	requests in order, per connection. The requests the agent
+ *	replies to before they are sent in full, e.g. with a 403 to a
+ *	PUT, are counted but not timed.
+ */
+typedef std::chrono::steady_clock rp_clock;
+
+struct rp_options
+{
+	string    file;
+	string    host;
+	uint16_t  port;
+	double    speed;       // 1 for the original pace, 0 for back to back
+	double    max_gap;     // sec, longer pauses are cut to this, 0 for no cap
+	int       timeout_ms;  // for the replies at the end
+
+	rp_options() { host = "127.0.0.1"; port = 10001; speed = 1; max_gap = 0; timeout_ms = 5000; }
+};
+
+struct rp_conn
+{
+	int       sk;
+	string    in;          // received, not yet parsed
+	uint64_t  body_left;   // of the request being sent
+	std::deque<rp_clock::time_point> sent;  // requests awaiting replies
+
+	rp_conn() { sk = -1; body_left = 0; }
+};
+
+struct rp_stats
+{
+	uint64_t  requests;
+	uint64_t  replies;
+	uint64_t  status[6];   // by 1xx ... 5xx, [0] for malformed
+	uint64_t  conns;
+	uint64_t  conn_errors; // couldn't connect or send
+	uint64_t  bytes_out;
+	vector<uint32_t> usec;
+	std::set<string> tokens;
+	bool      hashed;      // the tokens are
+
+	rp_stats() { requests = replies = conns = conn_errors = bytes_out = 0; hashed = false; memset(status, 0, sizeof status); }
+};
+
+static sockaddr_in          agent;
+static std::map<uint32_t, rp_conn> conns;  // by capture conn id
+static vector<rp_conn>      done;          // closed by us, draining
+static rp_stats             st;
+
+/*
+ *	replies
+ */
+static void on_reply(rp_conn & c, int status)
+{
+	st.replies++;
+	st.status[(status >= 100 && status < 600) ? status / 100 : 0]++;
+
+	if (c.sent.empty())
+		return; // replied to early
+
+	st.usec.push_back((uint32_t)std::min<int64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(rp_clock::now() - c.sent.front()).count(), UINT32_MAX));
+
+	c.sent.pop_front();
+}
+
+static void parse_replies(rp_conn & c)
+{
+	size_t end;
+
+	while ((end = c.in.find("\r\n\r\n")) != string::npos)
+	{
+		size_t clen = 0;
+		int    status = 0;
+
+		for (size_t at = 0; at < end; )
+		{
+			size_t eol = c.in.find("\r\n", at);
+
+			if (! at)
+				sscanf(c.in.c_str(), "HTTP/1.%*d %d", &status);
+			else
+			if (! strncasecmp(c.in.c_str() + at, "content-length:", 15))
+				clen = strtoul(c.in.c_str() + at + 15, NULL, 10);
+
+			at = eol + 2;
+		}
+
+		if (c.in.size() < end + 4 + clen)
+			return;
+
+		c.in.erase(0, end + 4 + clen);
+		on_reply(c, status);
+	}
+}
+
+// false once the agent has closed the connection
+static bool read_replies(rp_conn & c)
+{
+	char    buf[16*1024];
+	ssize_t n;
+
+	while ((n = recv(c.sk, buf, sizeof buf, MSG_DONTWAIT)) > 0)
+		c.in.append(buf, n);
+
+	parse_replies(c);
+
+	return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void close_conn(rp_conn & c)
+{
+	if (c.sk != -1)
+		::close(c.sk);
+
+	c.sk = -1;
+}
+
+/*
+ *	Reads whatever the agent sends till 'until', or only till all
+ *	connections are closed if 'draining'
+ */
+static void pump(rp_clock::time_point until, bool draining = false)
+{
+	for (;;)
+	{
+		vector<pollfd>   pf;
+		vector<rp_conn*> pc;
+		int ms;
+
+		for (auto & x : conns)
+			if (x.second.sk != -1)
+				pf.push_back({ x.second.sk, POLLIN, 0 }), pc.push_back(&x.second);
+
+		for (auto & c : done)
+			if (c.sk != -1)
+				pf.push_back({ c.sk, POLLIN, 0 }), pc.push_back(&c);
+
+		ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(until - rp_clock::now()).count();
+
+		if (ms < 0)
+			ms = 0;
+
+		if (pf.empty())
+		{
+			if (ms && ! draining)
+				poll(NULL, 0, ms);
+			return;
+		}
+
+		if (poll(pf.data(), pf.size(), ms) <= 0)
+			return;
+
+		for (size_t i=0; i<pf.size(); i++)
+			if (pf[i].revents && ! read_replies(*pc[i]))
+				close_conn(*pc[i]);
+
+		done.erase(std::remove_if(done.begin(), done.end(), [](const rp_conn & c){ return c.sk == -1; }), done.end());
+	}
+}
+
+/*
+ *	requests
+ */
+static bool send_all(rp_conn & c, const char * data, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = send(c.sk, data, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		data += n;
+		len  -= n;
+
+		// the agent may be busy replying on this very connection
+
+		if (len)
+			read_replies(c);
+	}
+
+	return true;
+}
+
+static void open_conn(uint32_t id)
+{
+	rp_conn & c = conns[id];
+	int yes = 1;
+
+	if (c.sk != -1)
+	{
+		done.push_back(c); // left open by the previous run
+		c = rp_conn();
+	}
+
+	c.sk = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (c.sk < 0 || connect(c.sk, (sockaddr*)&agent, sizeof agent) < 0)
+	{
+		close_conn(c);
+		st.conn_errors++;
+		return;
+	}
+
+	setsockopt(c.sk, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+	st.conns++;
+}
+
+static void end_conn(uint32_t id)
+{
+	auto i = conns.find(id);
+
+	if (i == conns.end())
+		return;
+
+	// let the replies to what's been sent come in
+
+	if (i->second.sk != -1)
+	{
+		shutdown(i->second.sk, SHUT_WR);
+		done.push_back(i->second);
+	}
+
+	conns.erase(i);
+}
+
+// the value of the first 'name' header, the name is with the colon
+static bool find_header(const char * head, size_t len, const char * name, string & value)
+{
+	size_t       n = strlen(name);
+	const char * end = head + len;
+	const char * p, * e;
+
+	for (p = head; (p = (const char *)memmem(p, end - p, "\r\n", 2)); )
+	{
+		p += 2;
+
+		if ((size_t)(end - p) < n || strncasecmp(p, name, n))
+			continue;
+
+		for (p += n; p < end && *p == ' '; p++);
+
+		e = (const char *)memmem(p, end - p, "\r\n", 2);
+		value.assign(p, e ? e - p : 0);
+		return true;
+	}
+
+	return false;
+}
+
+static void send_head(uint32_t id, const char * head, size_t len)
+{
+	rp_conn & c = conns[id];
+	string    clen, token;
+
+	st.requests++;
+
+	if (find_header(head, len, "x-access-token:", token))
+		st.tokens.insert(token);
+
+	if (c.sk == -1)
+		return;
+
+	// only PUTs get their payload read
+
+	c.body_left = 0;
+
+	if (! strncasecmp(head, "PUT ", 4) && find_header(head, len, "content-length:", clen))
+		c.body_left = strtoull(clen.c_str(), NULL, 10);
+
+	if (! send_all(c, head, len))
+	{
+		close_conn(c);
+		st.conn_errors++;
+		return;
+	}
+
+	st.bytes_out += len;
+
+	if (! c.body_left)
+		c.sent.push_back(rp_clock::now());
+}
+
+static void send_body(uint32_t id, const char * data, size_t len)
+{
+	rp_conn & c = conns[id];
+
+	if (c.sk == -1)
+		return;
+
+	if (! send_all(c, data, len))
+	{
+		close_conn(c);
+		st.conn_errors++;
+		return;
+	}
+
+	st.bytes_out += len;
+	c.body_left -= std::min<uint64_t>(c.body_left, len);
+
+	if (! c.body_left)
+		c.sent.push_back(rp_clock::now());
+}
+
+/*
+ *
+ */
+static uint32_t pct(const vector<uint32_t> & v, double p) // v is sorted
+{
+	if (v.empty())
+		return 0;
+
+	size_t i = (size_t)(p / 100 * (v.size() - 1) + .5);
+	return v[std::min(i, v.size() - 1)];
+}
+
+static int syntax()
+{
+	fprintf(stderr,
+		"Syntax: nb-replay [-a <host:port>] [-s <speed>] [-g <sec>] <capture>\n"
+		"\n"
+		"  -a  the agent, default 127.0.0.1:10001\n"
+		"  -s  1 for the original pace, default, 2 for twice as fast, etc.\n"
+		"      0 for back to back\n"
+		"  -g  cut longer pauses to this many seconds, default 0 - don't\n");
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	rp_options opt;
+	string     data;
+	cap_reader rd(data);
+	cap_record r;
+	const char * p;
+	uint64_t   t_first = 0, t_last = 0, t_cut = 0, records = 0;
+	bool       first = true;
+
+	for (int i=1; i<argc; i++)
+	{
+		string a = argv[i];
+
+		if (i + 1 == argc)
+		{
+			opt.file = a;
+			break;
+		}
+
+		string v = argv[++i];
+
+		if (a == "-s") opt.speed   = atof(v.c_str()); else
+		if (a == "-g") opt.max_gap = atof(v.c_str()); else
+		if (a == "-a")
+		{
+			size_t colon = v.rfind(':');
+
+			opt.host = v.substr(0, colon);
+			if (colon != string::npos)
+				opt.port = (uint16_t)atoi(v.c_str() + colon + 1);
+		}
+		else
+			return syntax();
+	}
+
+	if (opt.file.empty() || opt.speed < 0 || opt.max_gap < 0)
+		return syntax();
+
+	agent.sin_family = AF_INET;
+	agent.sin_port = htons(opt.port);
+
+	if (inet_pton(AF_INET, opt.host.c_str(), &agent.sin_addr) != 1)
+	{
+		addrinfo hints = { }, * res;
+
+		hints.ai_family = AF_INET;
+
+		if (getaddrinfo(opt.host.c_str(), NULL, &hints, &res) != 0)
+		{
+			fprintf(stderr, "Can't resolve %s\n", opt.host.c_str());
+			return 2;
+		}
+
+		agent.sin_addr = ((sockaddr_in*)res->ai_addr)->sin_addr;
+		freeaddrinfo(res);
+	}
+
+	if (! load_capture(opt.file, data))
+		return 2;
+
+	//
+	auto t0 = rp_clock::now();
+
+	while (rd.next(r, p))
+	{
+		records++;
+
+		// the pace, with the pauses cut
+
+		if (first)
+			t_first = t_last = r.time, first = false;
+
+		if (opt.max_gap > 0 && r.time > t_last + (uint64_t)(opt.max_gap * 1e6))
+			t_cut += r.time - t_last - (uint64_t)(opt.max_gap * 1e6);
+
+		t_last = std::max(t_last, r.time);
+
+		if (opt.speed > 0)
+			pump(t0 + std::chrono::microseconds((uint64_t)((r.time - t_first - t_cut) / opt.speed)));
+		else
+			pump(rp_clock::now());
+
+		switch (r.kind)
+		{
+		case cap_start:
+			st.hashed |= (r.flags & cap_hashed) != 0;
+
+			for (auto & x : conns)
+				if (x.second.sk != -1)
+					done.push_back(x.second);
+			conns.clear();
+			break;
+
+		case cap_open:  open_conn(r.conn); break;
+		case cap_close: end_conn(r.conn); break;
+		case cap_head:  send_head(r.conn, p, r.len); break;
+		case cap_body:  send_body(r.conn, p, r.len); break;
+		}
+	}
+
+	if (rd.cut_short())
+		fprintf(stderr, "The capture is cut short at %zu, replayed what's before it\n", rd.at);
+
+	// the replies still on the way
+
+	for (auto & x : conns)
+		if (x.second.sk != -1)
+		{
+			shutdown(x.second.sk, SHUT_WR);
+			done.push_back(x.second);
+		}
+
+	conns.clear();
+
+	auto limit = rp_clock::now() + std::chrono::milliseconds(opt.timeout_ms);
+
+	pump(limit, true);
+
+	for (auto & c : done)
+		close_conn(c);
+
+	//
+	double secs = std::chrono::duration<double>(rp_clock::now() - t0).count();
+
+	std::sort(st.usec.begin(), st.usec.end());
+
+	printf("%llu record(s), %.1f s captured, %.1f s replayed at %s\n",
+		(unsigned long long)records, (t_last - t_first) / 1e6, secs,
+		opt.speed > 0 ? stringf("%gx", opt.speed).c_str() : "full speed");
+
+	printf("%llu request(s), %llu repl(ies), %llu timed - p50 %u us, p99 %u us, p999 %u us, max %u us\n",
+		(unsigned long long)st.requests, (unsigned long long)st.replies, (unsigned long long)st.usec.size(),
+		pct(st.usec, 50), pct(st.usec, 99), pct(st.usec, 99.9), st.usec.empty() ? 0 : st.usec.back());
+
+	printf("replies: 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, malformed %llu\n",
+		(unsigned long long)st.status[2], (unsigned long long)st.status[3], (unsigned long long)st.status[4],
+		(unsigned long long)st.status[5], (unsigned long long)(st.status[0] + st.status[1]));
+
+	printf("%llu connection(s), %llu failed, %.1f MB sent\n",
+		(unsigned long long)st.conns, (unsigned long long)st.conn_errors, st.bytes_out / 1e6);
+
+	for (auto & t : st.tokens)
+		printf("token%s: %s\n", st.hashed ? " (hashed)" : "", t.c_str());
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "utils.h"
+
+#include <stdio.h>
+
+/*
+ *	The agent imports this from libp, see utils.h
+ */
+string stringf(const char * format, ...)
+{
+	va_list m;
+	string  r;
+	int     n;
+
+	va_start(m, format);
+	n = vsnprintf(NULL, 0, format, m);
+	va_end(m);
+
+	if (n <= 0)
+		return r;
+
+	r.resize(n + 1);
+
+	va_start(m, format);
+	vsnprintf(&r[0], n + 1, format, m);
+	va_end(m);
+
+	r.resize(n);
+	return r;
+}
@@ -0,0 +1,48 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "types.h"
+#include "config.h"
+#include "event_log.h"
+#include "utils.h"
+
+/*
+ *	What the parsing core links against from the rest of the
+ *	agent. Events go nowhere, traces go through the real tracer,
+ *	see nb-bench's main().
+ */
+app_config conf;
+
+void ev_put(uint16_t, uint32_t, uint64_t, uint64_t, const char *, size_t) { }
+
+//
+string to_utf8(const wchar_t * str, size_t len)
+{
+	string r;
+
+	if (len == (size_t)-1)
+		len = wcslen(str);
+
+	for (size_t i=0; i<len; i++)
+		r += (char)str[i]; // not used by the benchmarks
+
+	return r;
+}
+
+wstring to_wstr(const char * str, size_t len)
+{
+	wstring r;
+
+	if (len == (size_t)-1)
+		len = strlen(str);
+
+	for (size_t i=0; i<len; i++)
+		r += (wchar_t)(uint8_t)str[i];
+
+	return r;
+}
@@ -0,0 +1,39 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BENCH_SHLOBJ_H_
+#define _BENCH_SHLOBJ_H_
+
+/*
+ *	%LocalAppData% is $XDG_DATA_HOME or ~/.local/share
+ */
+#include <stdlib.h>
+#include "windows.h"
+
+#define CSIDL_LOCAL_APPDATA  0x001c
+
+inline BOOL SHGetSpecialFolderPath(HWND, wchar_t * path, int csid, BOOL)
+{
+	std::string dir;
+	const char * env;
+
+	if (csid != CSIDL_LOCAL_APPDATA)
+		return FALSE;
+
+	if ((env = getenv("XDG_DATA_HOME")) && *env)
+		dir = env;
+	else
+	if ((env = getenv("HOME")) && *env)
+		dir = std::string(env) + "/.local/share";
+	else
+		return FALSE;
+
+	return MultiByteToWideChar(CP_UTF8, 0, dir.c_str(), -1, path, MAX_PATH) != 0;
+}
+
+#endif
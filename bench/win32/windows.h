@@ -0,0 +1,560 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BENCH_WINDOWS_H_
+#define _BENCH_WINDOWS_H_
+
+/*
+ *	Just enough of <windows.h> for the agent, bar its UI, to
+ *	compile on Linux, see bench/CMakeLists.txt. Files are POSIX
+ *	descriptors, file mappings are mmap()s and threads are
+ *	std::threads. Names are converted to UTF-8 with the '\'s
+ *	flipped, so the agent's paths work as they are.
+ *
+ *	GetLastError() is errno rather than a Windows error code, it
+ *	is only ever printed.
+ */
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <map>
+
+// as <windows.h> brings in the intrinsics, and before __D from types.h
+#if defined __i386__ || defined __x86_64__
+#  pragma push_macro("__D")
+#  undef __D
+#  include <immintrin.h>
+#  pragma pop_macro("__D")
+#endif
+
+#define __stdcall
+#define WINAPI
+
+#define FALSE  0
+#define TRUE   1
+
+#define MAX_PATH  260
+
+typedef unsigned long  DWORD;
+typedef uint16_t       WORD;
+typedef long           LONG;
+typedef int64_t        LONGLONG;
+typedef size_t         SIZE_T;
+typedef void         * HANDLE;
+typedef void         * HWND;
+typedef int            BOOL;
+
+typedef union
+{
+	struct { uint32_t LowPart; int32_t HighPart; };
+	int64_t QuadPart;
+
+} LARGE_INTEGER;
+
+#define MAKEWORD(lo, hi)  ((WORD)(((hi) << 8) | ((lo) & 0xff)))
+
+inline DWORD GetLastError()         { return errno; }
+inline DWORD GetCurrentProcessId()  { return getpid(); }
+inline DWORD GetCurrentThreadId()   { return (DWORD)syscall(SYS_gettid); }
+
+/*
+ *	strings
+ */
+#define CP_UTF8  65001
+
+inline int WideCharToMultiByte(unsigned, DWORD, const wchar_t * str, int len, char * out, int cap, const char *, BOOL *)
+{
+	int n = 0;
+
+	if (len < 0)
+		len = (int)wcslen(str) + 1;
+
+	for (int i=0; i<len; i++)
+	{
+		uint32_t c = (uint32_t)str[i];
+		char     tmp[4];
+		int      k;
+
+		if (c < 0x80)         { tmp[0] = (char)c; k = 1; }
+		else if (c < 0x800)   { tmp[0] = (char)(0xC0 | c >> 6);  tmp[1] = (char)(0x80 | (c & 0x3F)); k = 2; }
+		else if (c < 0x10000) { tmp[0] = (char)(0xE0 | c >> 12); tmp[1] = (char)(0x80 | (c >> 6 & 0x3F)); tmp[2] = (char)(0x80 | (c & 0x3F)); k = 3; }
+		else                  { tmp[0] = (char)(0xF0 | c >> 18); tmp[1] = (char)(0x80 | (c >> 12 & 0x3F)); tmp[2] = (char)(0x80 | (c >> 6 & 0x3F)); tmp[3] = (char)(0x80 | (c & 0x3F)); k = 4; }
+
+		if (cap)
+		{
+			if (n + k > cap)
+				return 0;
+			memcpy(out + n, tmp, k);
+		}
+
+		n += k;
+	}
+
+	return n;
+}
+
+inline int MultiByteToWideChar(unsigned, DWORD, const char * str, int len, wchar_t * out, int cap)
+{
+	const uint8_t * p = (const uint8_t *)str;
+	const uint8_t * e;
+	int n = 0;
+
+	if (len < 0)
+		len = (int)strlen(str) + 1;
+
+	for (e = p + len; p < e; n++)
+	{
+		uint32_t c = *p++;
+		int      k = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+
+		if (c >= 0x80)
+			c &= 0x3F >> k;
+
+		for ( ; k && p < e && (*p & 0xC0) == 0x80; k--)
+			c = (c << 6) | (*p++ & 0x3F);
+
+		if (k)
+			c = 0xFFFD; // malformed
+
+		if (cap)
+		{
+			if (n == cap)
+				return 0;
+			out[n] = (wchar_t)c;
+		}
+	}
+
+	return n;
+}
+
+inline std::string win_path(const wchar_t * name)
+{
+	std::string r(WideCharToMultiByte(CP_UTF8, 0, name, (int)wcslen(name), NULL, 0, NULL, NULL), 0);
+
+	WideCharToMultiByte(CP_UTF8, 0, name, (int)wcslen(name), &r[0], (int)r.size(), NULL, NULL);
+
+	for (auto & ch : r)
+		if (ch == '\\')
+			ch = '/';
+
+	return r;
+}
+
+inline int wsprintf(wchar_t * buf, const wchar_t * format, ...)
+{
+	va_list m;
+	int     n;
+
+	va_start(m, format);
+	n = vswprintf(buf, 1024, format, m); // wsprintf's own limit
+	va_end(m);
+
+	return n;
+}
+
+/*
+ *	time
+ */
+typedef struct
+{
+	DWORD  dwLowDateTime;
+	DWORD  dwHighDateTime;
+
+} FILETIME;
+
+typedef struct
+{
+	WORD  wYear;
+	WORD  wMonth;
+	WORD  wDayOfWeek;
+	WORD  wDay;
+	WORD  wHour;
+	WORD  wMinute;
+	WORD  wSecond;
+	WORD  wMilliseconds;
+
+} SYSTEMTIME;
+
+inline uint64_t win_ft(const FILETIME * ft) { return ((uint64_t)ft->dwHighDateTime << 32) | ft->dwLowDateTime; }
+inline void     win_ft(FILETIME * ft, uint64_t v) { ft->dwLowDateTime = (DWORD)(uint32_t)v; ft->dwHighDateTime = (DWORD)(v >> 32); }
+
+#define WIN_EPOCH  116444736000000000ull // 1970 in FILETIME's 100ns ticks
+
+inline DWORD GetTickCount()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)(uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER * now)
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now->QuadPart = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER * freq)
+{
+	freq->QuadPart = 1000000000;
+	return TRUE;
+}
+
+inline void GetSystemTimeAsFileTime(FILETIME * ft)
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	win_ft(ft, WIN_EPOCH + (uint64_t)ts.tv_sec * 10000000 + ts.tv_nsec / 100);
+}
+
+inline BOOL FileTimeToLocalFileTime(const FILETIME * utc, FILETIME * loc)
+{
+	time_t t = (time_t)((win_ft(utc) - WIN_EPOCH) / 10000000);
+	tm     x;
+
+	if (! localtime_r(&t, &x))
+		return FALSE;
+
+	win_ft(loc, win_ft(utc) + (int64_t)x.tm_gmtoff * 10000000);
+	return TRUE;
+}
+
+inline BOOL FileTimeToSystemTime(const FILETIME * ft, SYSTEMTIME * st)
+{
+	uint64_t v = win_ft(ft) - WIN_EPOCH;
+	time_t   t = (time_t)(v / 10000000);
+	tm       x;
+
+	if (! gmtime_r(&t, &x))
+		return FALSE;
+
+	st->wYear   = (WORD)(x.tm_year + 1900);
+	st->wMonth  = (WORD)(x.tm_mon + 1);
+	st->wDayOfWeek = (WORD)x.tm_wday;
+	st->wDay    = (WORD)x.tm_mday;
+	st->wHour   = (WORD)x.tm_hour;
+	st->wMinute = (WORD)x.tm_min;
+	st->wSecond = (WORD)x.tm_sec;
+	st->wMilliseconds = (WORD)(v / 10000 % 1000);
+	return TRUE;
+}
+
+/*
+ *	handles - files, file mappings and threads
+ */
+struct win_handle
+{
+	int                fd;
+	uint64_t           size;    // of a mapping
+	bool               write;   // ditto
+	std::thread        thread;
+	std::atomic<bool>  done;    // the thread's
+
+	win_handle(int _fd = -1) : fd(_fd), size(0), write(false), done(false) { }
+};
+
+#define INVALID_HANDLE_VALUE   ((HANDLE)(intptr_t)-1)
+
+inline BOOL CloseHandle(HANDLE h)
+{
+	win_handle * w = (win_handle*)h;
+	int rc = 0;
+
+	if (w->thread.joinable())
+	{
+		if (w->done) w->thread.join();
+		else         w->thread.detach();
+	}
+
+	if (w->fd != -1)
+		rc = close(w->fd);
+
+	delete w;
+	return rc == 0;
+}
+
+// files
+
+#define GENERIC_READ           0x80000000
+#define GENERIC_WRITE          0x40000000
+#define FILE_APPEND_DATA       0x0004
+
+#define FILE_SHARE_READ        0x0001
+#define FILE_SHARE_WRITE       0x0002
+
+#define CREATE_NEW             1
+#define CREATE_ALWAYS          2
+#define OPEN_EXISTING          3
+#define OPEN_ALWAYS            4
+#define TRUNCATE_EXISTING      5
+
+#define FILE_ATTRIBUTE_DIRECTORY  0x0010
+#define FILE_ATTRIBUTE_NORMAL     0x0080
+#define INVALID_FILE_ATTRIBUTES   ((DWORD)-1)
+
+#define FILE_BEGIN             SEEK_SET
+#define FILE_CURRENT           SEEK_CUR
+#define FILE_END               SEEK_END
+
+#define MOVEFILE_REPLACE_EXISTING  0x0001
+
+inline HANDLE CreateFile(const wchar_t * name, DWORD access, DWORD, void *, DWORD disp, DWORD, HANDLE)
+{
+	static const int modes[] = { 0, O_CREAT | O_EXCL, O_CREAT | O_TRUNC, 0, O_CREAT, O_TRUNC };
+	int flags;
+	int fd;
+
+	if ((access & GENERIC_READ) && (access & (GENERIC_WRITE | FILE_APPEND_DATA)))
+		flags = O_RDWR;
+	else
+	if (access & GENERIC_READ)
+		flags = O_RDONLY;
+	else
+		flags = O_WRONLY;
+
+	if (access & FILE_APPEND_DATA)
+		flags |= O_APPEND;
+
+	if (disp < sizeof modes / sizeof modes[0])
+		flags |= modes[disp];
+
+	fd = open(win_path(name).c_str(), flags | O_CLOEXEC, 0644);
+
+	return (fd < 0) ? INVALID_HANDLE_VALUE : new win_handle(fd);
+}
+
+inline BOOL ReadFile(HANDLE h, void * data, DWORD size, DWORD * bytes, void *)
+{
+	ssize_t n;
+
+	for (*bytes = 0; *bytes < size; *bytes += n)
+	{
+		n = read(((win_handle*)h)->fd, (char*)data + *bytes, size - *bytes);
+
+		if (n < 0) return FALSE;
+		if (n == 0) break; // eof
+	}
+
+	return TRUE;
+}
+
+inline BOOL WriteFile(HANDLE h, const void * data, DWORD size, DWORD * bytes, void *)
+{
+	ssize_t n;
+
+	for (*bytes = 0; *bytes < size; *bytes += n)
+	{
+		n = write(((win_handle*)h)->fd, (const char*)data + *bytes, size - *bytes);
+
+		if (n < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+inline BOOL GetFileSizeEx(HANDLE h, LARGE_INTEGER * size)
+{
+	struct stat st;
+
+	if (fstat(((win_handle*)h)->fd, &st) < 0)
+		return FALSE;
+
+	size->QuadPart = st.st_size;
+	return TRUE;
+}
+
+inline DWORD SetFilePointer(HANDLE h, LONG lo, LONG * hi, DWORD method)
+{
+	off_t at = hi ? (off_t)(((uint64_t)*hi << 32) | (uint32_t)lo) : lo;
+
+	at = lseek(((win_handle*)h)->fd, at, (int)method);
+	if (at < 0)
+		return (DWORD)-1;
+
+	if (hi)
+		*hi = (LONG)(at >> 32);
+
+	return (DWORD)(uint32_t)at;
+}
+
+inline DWORD GetFileAttributes(const wchar_t * name)
+{
+	struct stat st;
+
+	if (stat(win_path(name).c_str(), &st) < 0)
+		return INVALID_FILE_ATTRIBUTES;
+
+	return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+inline BOOL CreateDirectory(const wchar_t * name, void *)
+{
+	return mkdir(win_path(name).c_str(), 0755) == 0;
+}
+
+inline BOOL DeleteFile(const wchar_t * name)
+{
+	return unlink(win_path(name).c_str()) == 0;
+}
+
+inline BOOL MoveFileEx(const wchar_t * from, const wchar_t * to, DWORD flags)
+{
+	unsigned how = (flags & MOVEFILE_REPLACE_EXISTING) ? 0 : RENAME_NOREPLACE;
+	return renameat2(AT_FDCWD, win_path(from).c_str(), AT_FDCWD, win_path(to).c_str(), how) == 0;
+}
+
+// file mappings, UnmapViewOfFile() and FlushViewOfFile() need the size back
+
+#define PAGE_READONLY    0x02
+#define PAGE_READWRITE   0x04
+
+#define FILE_MAP_WRITE   0x0002
+#define FILE_MAP_READ    0x0004
+
+inline std::map<void*, size_t> & win_views(std::unique_lock<std::mutex> & lock)
+{
+	static std::mutex              guard;
+	static std::map<void*, size_t> views;
+
+	lock = std::unique_lock<std::mutex>(guard);
+	return views;
+}
+
+inline HANDLE CreateFileMapping(HANDLE file, void *, DWORD protect, DWORD hi, DWORD lo, const wchar_t *)
+{
+	win_handle * map;
+	LARGE_INTEGER size;
+
+	if (! GetFileSizeEx(file, &size))
+		return NULL;
+
+	map = new win_handle(dup(((win_handle*)file)->fd));
+	map->size  = ((uint64_t)hi << 32) | lo;
+	map->write = (protect == PAGE_READWRITE);
+
+	if (map->size == 0)
+		map->size = size.QuadPart;
+
+	// a writable mapping extends the file, as it does on Windows
+	if (map->fd < 0 || (map->write && (uint64_t)size.QuadPart < map->size && ftruncate(map->fd, map->size) < 0))
+	{
+		CloseHandle(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+inline void * MapViewOfFile(HANDLE h, DWORD access, DWORD hi, DWORD lo, SIZE_T bytes)
+{
+	win_handle * map = (win_handle*)h;
+	std::unique_lock<std::mutex> lock;
+	void * view;
+
+	if (! bytes)
+		bytes = map->size;
+
+	view = mmap(NULL, bytes, (access & FILE_MAP_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ,
+	            MAP_SHARED, map->fd, (off_t)(((uint64_t)hi << 32) | lo));
+
+	if (view == MAP_FAILED)
+		return NULL;
+
+	win_views(lock)[view] = bytes;
+	return view;
+}
+
+inline BOOL FlushViewOfFile(const void * view, SIZE_T bytes)
+{
+	std::unique_lock<std::mutex> lock;
+	auto & views = win_views(lock);
+	auto   i = views.find((void*)view);
+
+	return i != views.end() && msync(i->first, bytes ? bytes : i->second, MS_SYNC) == 0;
+}
+
+inline BOOL UnmapViewOfFile(const void * view)
+{
+	std::unique_lock<std::mutex> lock;
+	auto & views = win_views(lock);
+	auto   i = views.find((void*)view);
+
+	if (i == views.end() || munmap(i->first, i->second) < 0)
+		return FALSE;
+
+	views.erase(i);
+	return TRUE;
+}
+
+// threads
+
+#define INFINITE        0xFFFFFFFF
+#define WAIT_OBJECT_0   0
+#define WAIT_TIMEOUT    258
+#define WAIT_FAILED     ((DWORD)-1)
+
+typedef DWORD (* LPTHREAD_START_ROUTINE)(void *);
+
+inline HANDLE CreateThread(void *, size_t, LPTHREAD_START_ROUTINE func, void * arg, DWORD, DWORD *)
+{
+	win_handle * h = new win_handle();
+
+	h->thread = std::thread([h, func, arg]() { func(arg); h->done = true; });
+	return h;
+}
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD ms)
+{
+	win_handle * w = (win_handle*)h;
+
+	if (! w->thread.joinable())
+		return w->done ? WAIT_OBJECT_0 : WAIT_FAILED;
+
+	for (DWORD t = 0; ms != INFINITE && ! w->done; t++)
+	{
+		if (t >= ms)
+			return WAIT_TIMEOUT;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	w->thread.join();
+	return WAIT_OBJECT_0;
+}
+
+/*
+ *	crt
+ */
+inline int _strnicmp(const char * a, const char * b, size_t n) { return strncasecmp(a, b, n); }
+
+#define _CRT_INTERNAL_LOCAL_SCANF_OPTIONS  0
+
+inline int __stdio_common_vsscanf(uint64_t, const char * buf, size_t len, const char * format, void *, va_list args)
+{
+	std::string tmp(buf, len); // it's not 0-terminated
+	return vsscanf(tmp.c_str(), format, args);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BENCH_WINSOCK2_H_
+#define _BENCH_WINSOCK2_H_
+
+/*
+ *	Just enough of <winsock2.h> for the engine to compile on
+ *	Linux, see windows.h next to it.
+ */
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "windows.h"
+
+typedef int            SOCKET;
+typedef unsigned long  u_long;
+
+#define WSAEWOULDBLOCK   EWOULDBLOCK
+#define WSAECONNRESET    ECONNRESET
+#define WSA_IO_PENDING   EINPROGRESS
+
+#define SD_SEND          SHUT_WR
+
+typedef struct
+{
+	WORD  wVersion;
+	WORD  wHighVersion;
+
+} WSADATA;
+
+inline int WSAStartup(WORD version, WSADATA * data) { data->wVersion = data->wHighVersion = version; return 0; }
+inline int WSAGetLastError()             { return errno; }
+inline int closesocket(SOCKET sk)        { return close(sk); }
+inline int ioctlsocket(SOCKET sk, long cmd, u_long * arg) { return ioctl(sk, cmd, arg); }
+
+// winsock's lengths are ints
+
+inline SOCKET accept(SOCKET sk, sockaddr * addr, int * len)
+{
+	socklen_t n = *len;
+	SOCKET    r = accept(sk, addr, &n);
+
+	*len = (int)n;
+	return r;
+}
+
+inline int getsockname(SOCKET sk, sockaddr * addr, int * len)
+{
+	socklen_t n = *len;
+	int       r = getsockname(sk, addr, &n);
+
+	*len = (int)n;
+	return r;
+}
+
+// winsock ignores the first argument, the sets are lists of sockets
+
+inline int win_select(int, fd_set * rd, fd_set * wr, fd_set * ex, timeval * tv)
+{
+	return select(sizeof(fd_set) * 8, rd, wr, ex, tv);
+}
+
+#define select  win_select
+
+#endif
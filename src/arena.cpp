@@ -0,0 +1,68 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "arena.h"
+
+//
+arena::arena(size_t _block_size)
+{
+	block_size = _block_size;
+	last = used = first = 0;
+	mallocs = 0;
+}
+
+arena::~arena()
+{
+	for (auto b : blocks)
+		free(b);
+}
+
+void * arena::alloc(size_t bytes)
+{
+	char * ptr;
+
+	bytes = (bytes + 7) & ~(size_t)7;
+
+	if (blocks.empty() || last - used < bytes)
+	{
+		size_t size = (bytes < block_size) ? block_size : bytes;
+
+		ptr = (char*)malloc(size);
+		__enforce(ptr);
+
+		mallocs++;
+
+		if (blocks.empty())
+			first = size;
+
+		blocks.push_back(ptr);
+		last = size;
+		used = 0;
+	}
+
+	ptr = blocks.back() + used;
+	used += bytes;
+
+	return ptr;
+}
+
+/*
+ *	Blocks past the first one are only needed by larger requests,
+ *	so these are let go of.
+ */
+void arena::reset()
+{
+	for (size_t i=1; i<blocks.size(); i++)
+		free(blocks[i]);
+
+	if (blocks.size() > 1)
+		blocks.resize(1);
+
+	last = first;
+	used = 0;
+}
@@ -0,0 +1,116 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "types.h"
+#include "enforce.h"
+
+#include <type_traits>
+
+/*
+ *	A bump allocator for the short-lived bits of a request. There
+ *	is no freeing individual allocations, the whole thing is reset
+ *	at once. The first block is kept across the resets, so for the
+ *	requests that fit in it there are no heap allocations at all.
+ */
+struct arena
+{
+	arena(size_t block_size = 4096);
+	~arena();
+
+	void * alloc(size_t bytes); // 8-aligned
+	void   reset();
+
+	size_t heap_allocs() const { return mallocs; } // blocks malloc'ed so far
+
+private:
+	arena(const arena &) = delete;
+	void operator = (const arena &) = delete;
+
+	vector<char*>  blocks;
+	size_t         last;   // size of blocks.back()
+	size_t         used;   // of blocks.back()
+	size_t         first;  // size of blocks[0]
+	size_t         block_size;
+	size_t         mallocs;
+};
+
+/*
+ *	A vector of trivially copyable items that lives in an arena.
+ *	Growing it leaves the old items behind in the arena, which is
+ *	fine as long as the arena is short-lived.
+ */
+template <class T>
+struct arena_vec
+{
+	static_assert(std::is_trivially_copyable<T>::value, "arena_vec items are memcpy'd");
+
+	explicit arena_vec(arena * _mem) { mem = _mem; items = NULL; count = 0; cap = 0; }
+
+	size_t size() const  { return count; }
+	bool   empty() const { return ! count; }
+
+	T & operator [] (size_t i) { __enforce(i < count); return items[i]; }
+	const T & operator [] (size_t i) const { __enforce(i < count); return items[i]; }
+
+	T & back() { __enforce(count); return items[count-1]; }
+
+	T * begin() { return items; }
+	T * end()   { return items + count; }
+	const T * begin() const { return items; }
+	const T * end()   const { return items + count; }
+
+	void push_back(const T & item)
+	{
+		if (count == cap)
+			reserve(cap ? 2*cap : 8);
+
+		items[count++] = item;
+	}
+
+	void resize(size_t n)
+	{
+		reserve(n);
+
+		for (size_t i=count; i<n; i++)
+			items[i] = T();
+
+		count = n;
+	}
+
+	void reserve(size_t n)
+	{
+		T * tmp;
+
+		if (n <= cap)
+			return;
+
+		tmp = (T*)mem->alloc(n * sizeof(T));
+		if (count)
+			memcpy(tmp, items, count * sizeof(T));
+
+		items = tmp;
+		cap = n;
+	}
+
+	void clear() { count = 0; }
+	void reset() { items = NULL; count = 0; cap = 0; } // when the arena is reset
+
+private:
+	arena_vec(const arena_vec &) = delete;
+	void operator = (const arena_vec &) = delete;
+
+	arena  * mem;
+	T      * items;
+	size_t   count;
+	size_t   cap;
+};
+
+#endif
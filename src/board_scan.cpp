@@ -0,0 +1,841 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "simd.h"
+#include "board_scan.h"
+
+/*
+ *	scan_number() states, following the JSON number grammar -
+ *
+ *	-? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?
+ */
+enum
+{
+	n_sign = 1,  // after '-'
+	n_zero,      // after the leading 0
+	n_int,
+	n_dot,
+	n_frac,
+	n_e,
+	n_exp_sign,
+	n_exp,
+};
+
+static inline
+bool is_digit(char ch)
+{
+	return '0' <= ch && ch <= '9';
+}
+
+static inline
+bool is_hex(char ch)
+{
+	return is_digit(ch) || ('a' <= (ch | 0x20) && (ch | 0x20) <= 'f');
+}
+
+/*
+ *
+ */
+void board_scan::reset()
+{
+	format = json_u64();
+	id = json_u64();
+	revision = json_u64();
+	has_title = false;
+	title.clear();
+	error = NULL;
+
+	state = st_start;
+	stack.clear();
+
+	in_key = false;
+	esc = 0;
+	key.clear();
+
+	num = 0;
+	num_val = 0;
+	num_ok = false;
+
+	lit = NULL;
+
+	key_field = f_none;
+	capture = f_none;
+	title_raw.clear();
+}
+
+bool board_scan::feed(const ch_range & piece)
+{
+	const char * p   = piece.data;
+	const char * end = p + piece.size;
+
+	while (p < end && state != st_bad)
+	{
+		char ch;
+
+		if (stack.size() > 1 && state != st_string && state != st_number && state != st_literal)
+		{
+			p = scan_nested(p, end);
+
+			if (p == end || state == st_bad)
+				break;
+		}
+
+		if (state == st_string)
+		{
+			p = scan_string(p, end);
+			continue;
+		}
+
+		ch = *p;
+
+		if (state == st_number)
+		{
+			if (scan_number(ch))
+				p++;
+			else
+				end_number(); // and 'ch' is looked at again
+
+			continue;
+		}
+
+		p++;
+
+		if (state == st_literal)
+		{
+			if (ch != *lit)
+				fail("Invalid literal");
+			else
+			if (! *++lit)
+				end_value();
+
+			continue;
+		}
+
+		if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+			continue;
+
+		switch (state)
+		{
+		case st_start:
+			if (ch == '{') push('{'); else fail("Not an object");
+			break;
+
+		case st_key_or_end:
+			if (ch == '}')
+			{
+				pop('{');
+				break;
+			}
+			// fall through
+		case st_key:
+			if (ch == '"')
+			{
+				state = st_string;
+				in_key = true;
+				esc = 0;
+				key.clear();
+			}
+			else
+				fail("Expected a key");
+			break;
+
+		case st_colon:
+			if (ch == ':') state = st_value; else fail("Expected ':'");
+			break;
+
+		case st_value_or_end:
+			if (ch == ']')
+			{
+				pop('[');
+				break;
+			}
+			// fall through
+		case st_value:
+			begin_value(ch);
+
+			// the rest of a literal, if it's all here
+			if (state == st_literal)
+			{
+				size_t n = strlen(lit);
+				if (end - p >= (ptrdiff_t)n && ! memcmp(p, lit, n))
+				{
+					p += n;
+					end_value();
+				}
+			}
+			break;
+
+		case st_comma:
+			if (ch == ',') state = (stack.back() == '{') ? st_key : st_value; else
+			if (ch == '}') pop('{'); else
+			if (ch == ']') pop('['); else
+				fail("Expected ',' or a closing bracket");
+			break;
+
+		case st_done:
+			fail("Data past the end of the object");
+			break;
+
+		default:
+			__enforce(false);
+		}
+	}
+
+	return state != st_bad;
+}
+
+bool board_scan::finish()
+{
+	size_t i, n;
+
+	if (state == st_bad)
+		return false;
+
+	if (state != st_done)
+	{
+		fail("Incomplete data");
+		return false;
+	}
+
+	// unescape the title, it's cut at max_title, so may end mid-escape
+
+	title.clear();
+	n = title_raw.size();
+
+	for (i=0; i<n; i++)
+	{
+		char ch = title_raw[i];
+
+		if (ch != '\\')
+		{
+			title += ch;
+			continue;
+		}
+
+		if (++i == n)
+			break;
+
+		ch = title_raw[i];
+
+		if (ch == 'b') title += '\b'; else
+		if (ch == 'f') title += '\f'; else
+		if (ch == 'n') title += '\n'; else
+		if (ch == 'r') title += '\r'; else
+		if (ch == 't') title += '\t'; else
+		if (ch != 'u') title += ch;   else
+		{
+			uint_t cp, lo;
+
+			if (i + 4 >= n || sscanf(title_raw.c_str() + i + 1, "%4x", &cp) != 1)
+				break;
+
+			i += 4;
+
+			if (0xD800 <= cp && cp < 0xDC00 && i + 6 < n &&
+			    title_raw[i+1] == '\\' && title_raw[i+2] == 'u' &&
+			    sscanf(title_raw.c_str() + i + 3, "%4x", &lo) == 1 &&
+			    0xDC00 <= lo && lo < 0xE000)
+			{
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				i += 6;
+			}
+			else
+			if (0xD800 <= cp && cp < 0xE000)
+			{
+				cp = 0xFFFD; // lone surrogate
+			}
+
+			if (cp < 0x80)
+			{
+				title += (char)cp;
+			}
+			else
+			if (cp < 0x800)
+			{
+				title += (char)(0xC0 | (cp >> 6));
+				title += (char)(0x80 | (cp & 0x3F));
+			}
+			else
+			if (cp < 0x10000)
+			{
+				title += (char)(0xE0 | (cp >> 12));
+				title += (char)(0x80 | ((cp >> 6) & 0x3F));
+				title += (char)(0x80 | (cp & 0x3F));
+			}
+			else
+			{
+				title += (char)(0xF0 | (cp >> 18));
+				title += (char)(0x80 | ((cp >> 12) & 0x3F));
+				title += (char)(0x80 | ((cp >> 6) & 0x3F));
+				title += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ *	private
+ */
+/*
+ *	The fast lane for the bulk of a board - the values below the
+ *	top level, where there are no fields to pick up. The strings
+ *	are taken whole and the rest a token at a time, without going
+ *	through the states a byte at a time. The numbers, the grammar
+ *	errors and whatever is cut short by 'end' are left to feed().
+ */
+const char * board_scan::scan_nested(const char * p, const char * end)
+{
+	while (p < end && stack.size() > 1)
+	{
+		const char * q;
+		char ch = *p;
+
+		if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+		{
+			p++;
+			continue;
+		}
+
+		switch (state)
+		{
+		case st_key_or_end:
+			if (ch == '}')
+			{
+				pop('{');
+				p++;
+				continue;
+			}
+			// fall through
+		case st_key:
+			if (ch != '"' || (q = json_skip_string(p+1, end)) == end || *q != '"')
+				return p;
+
+			key_field = f_none;
+			state = st_colon;
+			p = q+1;
+
+			if (p < end && *p == ':') // as it mostly is
+			{
+				state = st_value;
+				p++;
+			}
+			continue;
+
+		case st_colon:
+			if (ch != ':')
+				return p;
+
+			state = st_value;
+			p++;
+			continue;
+
+		case st_value_or_end:
+			if (ch == ']')
+			{
+				pop('[');
+				p++;
+				continue;
+			}
+			// fall through
+		case st_value:
+			key_field = f_none;
+			capture = f_none;
+
+			if (ch == '"')
+			{
+				if ((q = json_skip_string(p+1, end)) == end || *q != '"')
+					return p;
+
+				end_value();
+				p = q+1;
+				continue;
+			}
+
+			if (ch == '{' || ch == '[')
+			{
+				push(ch);
+				p++;
+				continue;
+			}
+
+			if (ch == 't' && end - p >= 4 && p[1] == 'r' && p[2] == 'u' && p[3] == 'e')
+			{
+				end_value();
+				p += 4;
+				continue;
+			}
+
+			if (ch == 'f' && end - p >= 5 && p[1] == 'a' && p[2] == 'l' && p[3] == 's' && p[4] == 'e')
+			{
+				end_value();
+				p += 5;
+				continue;
+			}
+
+			if (ch == 'n' && end - p >= 4 && p[1] == 'u' && p[2] == 'l' && p[3] == 'l')
+			{
+				end_value();
+				p += 4;
+				continue;
+			}
+
+			return p;
+
+		case st_comma:
+			if (ch == ',') state = (stack.back() == '{') ? st_key : st_value; else
+			if (ch == '}') pop('{'); else
+			if (ch == ']') pop('['); else
+				return p;
+
+			p++;
+			continue;
+
+		default:
+			return p;
+		}
+	}
+
+	return p;
+}
+
+const char * board_scan::scan_string(const char * p, const char * end)
+{
+	bool want = in_key ? (stack.size() == 1) : (capture == f_title);
+
+	while (p < end)
+	{
+		const char * q;
+		char ch;
+
+		if (esc)
+		{
+			ch = *p;
+
+			if (esc == 1)
+			{
+				if (ch == 'u')
+					esc = 2;
+				else
+				if (ch && strchr("\"\\/bfnrt", ch))
+					esc = 0;
+				else
+				{
+					fail("Invalid escape");
+					break;
+				}
+			}
+			else
+			{
+				if (! is_hex(ch))
+				{
+					fail("Invalid \\u escape");
+					break;
+				}
+
+				if (++esc == 6)
+					esc = 0;
+			}
+
+			if (want)
+				keep(p, 1);
+
+			p++;
+			continue;
+		}
+
+		q = json_skip_string(p, end);
+
+		if (want)
+			keep(p, q-p);
+
+		if (q == end)
+			break;
+
+		if (*q == '"')
+		{
+			end_string();
+			return q+1;
+		}
+
+		if (*q != '\\')
+		{
+			fail("Control character in a string");
+			break;
+		}
+
+		esc = 1;
+
+		if (want)
+			keep(q, 1);
+
+		p = q+1;
+	}
+
+	return end;
+}
+
+bool board_scan::scan_number(char ch)
+{
+	bool digit = is_digit(ch);
+
+	if (digit && (num == n_sign || num == n_int))
+	{
+		uint_t d = ch - '0';
+
+		if (num_val > (0xffffffffffffffffull - d) / 10)
+			num_ok = false;
+
+		num_val = num_val * 10 + d;
+		num = (num == n_sign && ! d) ? n_zero : n_int;
+		return true;
+	}
+
+	if ((ch == '.') && (num == n_zero || num == n_int))
+	{
+		num = n_dot;
+		num_ok = false;
+		return true;
+	}
+
+	if ((ch == 'e' || ch == 'E') && (num == n_zero || num == n_int || num == n_frac))
+	{
+		num = n_e;
+		num_ok = false;
+		return true;
+	}
+
+	if ((ch == '+' || ch == '-') && num == n_e)
+	{
+		num = n_exp_sign;
+		return true;
+	}
+
+	if (digit)
+	{
+		if (num == n_dot || num == n_frac) { num = n_frac; return true; }
+		if (num == n_e || num == n_exp_sign || num == n_exp) { num = n_exp; return true; }
+	}
+
+	return false;
+}
+
+void board_scan::keep(const char * p, size_t n)
+{
+	size_t room;
+
+	if (in_key)
+	{
+		// top-level keys only and only enough to tell if it's too long
+		if (stack.size() != 1 || key.size() > max_key)
+			return;
+
+		room = max_key + 1 - key.size();
+		key.append(p, (n < room) ? n : room);
+		return;
+	}
+
+	if (capture != f_title || title_raw.size() >= max_title)
+		return;
+
+	room = max_title - title_raw.size();
+	title_raw.append(p, (n < room) ? n : room);
+}
+
+/*
+ *	Only the first value of a field counts, and if it's of the
+ *	wrong type, the field is still seen, but not ok.
+ */
+void board_scan::begin_value(char ch)
+{
+	json_u64 * field = NULL;
+
+	capture = (stack.size() == 1) ? key_field : f_none;
+	key_field = f_none;
+
+	if (capture == f_format)   field = &format;   else
+	if (capture == f_id)       field = &id;       else
+	if (capture == f_revision) field = &revision;
+
+	if (ch == '"')
+	{
+		state = st_string;
+		in_key = false;
+		esc = 0;
+		return;
+	}
+
+	if (ch == '-' || is_digit(ch))
+	{
+		state = st_number;
+		num = (ch == '-') ? n_sign : (ch == '0') ? n_zero : n_int;
+		num_val = (ch == '-') ? 0 : ch - '0';
+		num_ok = (ch != '-');
+		return;
+	}
+
+	if (field)
+		field->seen = true;
+
+	if (capture == f_title)
+		has_title = true; // with an empty title
+
+	capture = f_none;
+
+	if (ch == '{') push('{'); else
+	if (ch == '[') push('['); else
+	if (ch == 't') { state = st_literal; lit = "rue";  } else
+	if (ch == 'f') { state = st_literal; lit = "alse"; } else
+	if (ch == 'n') { state = st_literal; lit = "ull";  } else
+		fail("Unexpected character");
+}
+
+void board_scan::end_value()
+{
+	capture = f_none;
+	state = stack.empty() ? st_done : st_comma;
+}
+
+void board_scan::end_number()
+{
+	json_u64 * field = NULL;
+
+	if (num != n_zero && num != n_int && num != n_frac && num != n_exp)
+	{
+		fail("Malformed number");
+		return;
+	}
+
+	if (capture == f_format)   field = &format;   else
+	if (capture == f_id)       field = &id;       else
+	if (capture == f_revision) field = &revision;
+
+	if (field)
+	{
+		field->seen = true;
+		field->ok = num_ok;
+		field->val = num_ok ? num_val : 0;
+	}
+
+	if (capture == f_title)
+		has_title = true;
+
+	end_value();
+}
+
+void board_scan::end_string()
+{
+	if (! in_key)
+	{
+		if (capture == f_title)   has_title = true;     else
+		if (capture == f_format)  format.seen = true;   else
+		if (capture == f_id)      id.seen = true;       else
+		if (capture == f_revision) revision.seen = true;
+
+		end_value();
+		return;
+	}
+
+	in_key = false;
+	key_field = f_none;
+	state = st_colon;
+
+	if (stack.size() != 1)
+		return;
+
+	if (key == "format"   && ! format.seen)   key_field = f_format;   else
+	if (key == "id"       && ! id.seen)       key_field = f_id;       else
+	if (key == "revision" && ! revision.seen) key_field = f_revision; else
+	if (key == "title"    && ! has_title)     key_field = f_title;
+}
+
+void board_scan::push(char bracket)
+{
+	if (stack.size() == max_depth)
+	{
+		fail("Nested too deep");
+		return;
+	}
+
+	stack.push_back(bracket);
+	state = (bracket == '{') ? st_key_or_end : st_value_or_end;
+}
+
+void board_scan::pop(char bracket)
+{
+	if (stack.back() != bracket)
+	{
+		fail("Mismatched bracket");
+		return;
+	}
+
+	stack.pop_back();
+	end_value();
+}
+
+void board_scan::fail(const char * why)
+{
+	if (state != st_bad)
+		error = why;
+
+	state = st_bad;
+}
+
+/*
+ *	json_skip_string
+ */
+static inline
+size_t escape_len(const char * p, const char * end) // 0 if it's invalid or cut short
+{
+	if (end - p < 2)
+		return 0;
+
+	switch (p[1])
+	{
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+		return 2;
+
+	case 'u':
+		return (end - p >= 6 && is_hex(p[2]) && is_hex(p[3]) && is_hex(p[4]) && is_hex(p[5])) ? 6 : 0;
+	}
+
+	return 0;
+}
+
+const char * json_skip_string_scalar(const char * p, const char * end)
+{
+	while (p < end)
+	{
+		size_t n;
+
+		if (*p == '"' || (uint8_t)*p < 0x20)
+			return p;
+
+		if (*p != '\\')
+		{
+			p++;
+			continue;
+		}
+
+		if (! (n = escape_len(p, end)))
+			return p;
+
+		p += n;
+	}
+
+	return end;
+}
+
+#ifdef HAS_X86_SIMD
+
+/*
+ *	A block at a time, with the escapes checked off the mask in
+ *	place, so that a string with escapes in it is still skipped
+ *	in bulk. An escape may run into the next block, which is then
+ *	loaded from right past it. Control chars are caught with an
+ *	unsigned max, as there is no unsigned compare in SSE2.
+ */
+const char * json_skip_string_sse2(const char * p, const char * end)
+{
+	const __m128i quote  = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i ctl    = _mm_set1_epi8(0x1F);
+
+	while (end - p >= 16)
+	{
+		__m128i      v = _mm_loadu_si128((const __m128i*)p);
+		__m128i      s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+		                              _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+		uint32_t     m = _mm_movemask_epi8(s);
+		const char * at = p; // skipped up to, escapes may run past the block
+
+		while (m)
+		{
+			const char * q = p + ctz32(m);
+			size_t       n;
+
+			if (q >= at)
+			{
+				if (*q != '\\' || ! (n = escape_len(q, end)))
+					return q;
+
+				at = q + n;
+			}
+
+			m &= m - 1;
+		}
+
+		p = (at > p + 16) ? at : p + 16;
+	}
+
+	return json_skip_string_scalar(p, end);
+}
+
+__target_avx2
+const char * json_skip_string_avx2(const char * p, const char * end)
+{
+	const __m256i quote  = _mm256_set1_epi8('"');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i ctl    = _mm256_set1_epi8(0x1F);
+
+	while (end - p >= 32)
+	{
+		__m256i      v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i      s = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+		                                 _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl));
+		uint32_t     m = _mm256_movemask_epi8(s);
+		const char * at = p; // skipped up to, escapes may run past the block
+
+		while (m)
+		{
+			const char * q = p + ctz32(m);
+			size_t       n;
+
+			if (q >= at)
+			{
+				if (*q != '\\' || ! (n = escape_len(q, end)))
+					return q;
+
+				at = q + n;
+			}
+
+			m &= m - 1;
+		}
+
+		p = (at > p + 32) ? at : p + 32;
+	}
+
+	return json_skip_string_sse2(p, end);
+}
+
+#else
+
+const char * json_skip_string_sse2(const char * p, const char * end) { return json_skip_string_scalar(p, end); }
+const char * json_skip_string_avx2(const char * p, const char * end) { return json_skip_string_scalar(p, end); }
+
+#endif
+
+/*
+ *
+ */
+typedef const char * (* json_skip_string_fn)(const char * p, const char * end);
+
+static json_skip_string_fn pick_skip_string()
+{
+	if (cpu_has_avx2()) return json_skip_string_avx2;
+	if (cpu_has_sse2()) return json_skip_string_sse2;
+	return json_skip_string_scalar;
+}
+
+const char * json_skip_string(const char * p, const char * end)
+{
+	static const json_skip_string_fn fn = pick_skip_string();
+	return fn(p, end);
+}
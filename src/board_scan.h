@@ -0,0 +1,131 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BOARD_SCAN_H_
+#define _BOARD_SCAN_H_
+
+#include "types.h"
+#include "ch_range.h"
+
+//
+struct json_u64
+{
+	bool      seen;
+	bool      ok;     // a non-negative integer that fits into 64 bits
+	uint64_t  val;
+
+	json_u64() { seen = false; ok = false; val = 0; }
+};
+
+/*
+ *	Validates board JSON as it is coming in, in pieces, and picks
+ *	up the top-level "format", "id", "revision" and "title" along
+ *	the way. Only the top-level fields are looked at, so the same
+ *	text in a note doesn't count, and if a field is repeated, the
+ *	first one is used.
+ *
+ *	The top-level value must be an object. The grammar is checked
+ *	in full, but the string contents are not checked to be valid
+ *	UTF-8.
+ */
+struct board_scan
+{
+	board_scan() { reset(); }
+
+	void reset();
+
+	bool feed(const ch_range & piece); // false once the data is malformed
+	bool finish();                     // true if it was a complete JSON object
+
+	json_u64      format;
+	json_u64      id;
+	json_u64      revision;
+	bool          has_title;
+	string        title;  // unescaped, set by finish()
+
+	const char  * error;  // if feed() or finish() fails
+
+	static const size_t max_depth = 256;
+	static const size_t max_title = 256;  // escaped bytes kept
+
+private:
+	enum
+	{
+		st_start,       // expecting the top-level '{'
+		st_key_or_end,  // after '{'
+		st_key,         // after ',' in an object
+		st_colon,
+		st_value_or_end,// after '['
+		st_value,       // after ':' or ',' in an array
+		st_comma,       // after a value, expecting ',' or closing bracket
+		st_string,
+		st_number,
+		st_literal,
+		st_done,        // past the top-level '}'
+		st_bad
+	};
+
+	enum
+	{
+		f_none,
+		f_format,
+		f_id,
+		f_revision,
+		f_title,
+	};
+
+	const char * scan_nested(const char * p, const char * end);
+	const char * scan_string(const char * p, const char * end);
+	bool         scan_number(char ch);
+	void         keep(const char * p, size_t n);
+
+	void begin_value(char ch);
+	void end_value();
+	void end_number();
+	void end_string();
+	void push(char bracket);
+	void pop(char bracket);
+	void fail(const char * why);
+
+	int           state;
+	vector<char>  stack;    // of '{' and '['
+
+	// st_string
+	bool          in_key;
+	int           esc;      // 0, 1 after '\', 2..5 within \uXXXX
+	string        key;      // top-level only, up to max_key
+
+	// st_number
+	int           num;      // see scan_number()
+	uint64_t      num_val;
+	bool          num_ok;
+
+	// st_literal
+	const char  * lit;
+
+	// the top-level field being read
+	int           key_field;
+	int           capture;
+	string        title_raw;
+
+	static const size_t max_key = 16;
+};
+
+/*
+ *	Skips the inside of a JSON string - the plain bytes and the
+ *	valid escapes - up to the closing '"', a control char or an
+ *	escape that is either invalid or cut short by 'end'. Returns
+ *	'end' if there's none. The variants are exposed for testing.
+ */
+const char * json_skip_string(const char * p, const char * end);
+
+const char * json_skip_string_scalar(const char * p, const char * end);
+const char * json_skip_string_sse2(const char * p, const char * end);
+const char * json_skip_string_avx2(const char * p, const char * end);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "buf_pool.h"
+
+//
+buf_pool::~buf_pool()
+{
+	trim();
+}
+
+/*
+ *	-1 for sizes that are too large to be cached
+ */
+int buf_pool::class_of(size_t size)
+{
+	size_t cap = min_size;
+	int i;
+
+	for (i=0; i<classes; i++, cap *= 2)
+		if (size <= cap)
+			return i;
+
+	return -1;
+}
+
+char * buf_pool::get(size_t size)
+{
+	int    i = class_of(size);
+	size_t bytes = (i < 0) ? size : (min_size << i);
+	char * ptr;
+
+	__enforce(size);
+
+	stats.gets++;
+
+	if (i >= 0 && free_list[i].size())
+	{
+		ptr = free_list[i].back();
+		free_list[i].pop_back();
+
+		stats.hits++;
+		stats.cached -= bytes;
+	}
+	else
+	{
+		ptr = (char*)malloc(bytes);
+		__enforce(ptr);
+	}
+
+	stats.in_use += bytes;
+
+	if (stats.peak < stats.in_use + stats.cached)
+		stats.peak = stats.in_use + stats.cached;
+
+	return ptr;
+}
+
+void buf_pool::put(char * ptr, size_t size)
+{
+	int    i = class_of(size);
+	size_t bytes = (i < 0) ? size : (min_size << i);
+
+	if (! ptr)
+		return;
+
+	__enforce(bytes <= stats.in_use);
+
+	stats.puts++;
+	stats.in_use -= bytes;
+
+	if (i < 0 || stats.cached + bytes > watermark)
+	{
+		stats.released++;
+		free(ptr);
+		return;
+	}
+
+	free_list[i].push_back(ptr);
+	stats.cached += bytes;
+}
+
+/*
+ *	Swaps 'ptr' for a buffer of 'new_size' with the first 'keep'
+ *	bytes carried over
+ */
+char * buf_pool::grow(char * ptr, size_t size, size_t keep, size_t new_size)
+{
+	char * tmp;
+
+	__enforce(keep <= size && keep <= new_size);
+
+	tmp = get(new_size);
+
+	if (keep)
+		memcpy(tmp, ptr, keep);
+
+	put(ptr, size);
+
+	return tmp;
+}
+
+void buf_pool::trim()
+{
+	for (int i=0; i<classes; i++)
+	{
+		for (auto ptr : free_list[i])
+			free(ptr);
+
+		free_list[i].clear();
+		free_list[i].shrink_to_fit();
+	}
+
+	stats.cached = 0;
+}
+
+void buf_pool::get_stats(buf_pool_stats & out) const
+{
+	out = stats;
+}
@@ -0,0 +1,60 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _BUF_POOL_H_
+#define _BUF_POOL_H_
+
+#include "types.h"
+
+//
+struct buf_pool_stats
+{
+	uint64_t  gets;
+	uint64_t  hits;       // ... served from a free list
+	uint64_t  puts;
+	uint64_t  released;   // ... freed right away instead of being cached
+	size_t    cached;     // bytes in the free lists
+	size_t    in_use;     // bytes handed out
+	size_t    peak;       // of cached + in_use
+
+	buf_pool_stats() { memset(this, 0, sizeof *this); }
+};
+
+/*
+ *	Uninitialised byte buffers, recycled through free lists of
+ *	power-of-2 sizes from min_size to max_cached. Anything larger
+ *	is not cached and neither is anything that would push cached
+ *	bytes over the watermark - these are freed as they come back.
+ *
+ *	Not thread-safe, meant to be used by the engine thread only.
+ */
+struct buf_pool
+{
+	~buf_pool();
+
+	char * get(size_t size);
+	void   put(char * ptr, size_t size); // same size as in get()
+	char * grow(char * ptr, size_t size, size_t keep, size_t new_size);
+
+	void   trim(); // frees all cached buffers
+	void   get_stats(buf_pool_stats & stats) const;
+
+	static const size_t min_size   = 8*1024;
+	static const size_t max_cached = 1024*1024;
+	static const size_t watermark  = 4*1024*1024;
+
+private:
+	enum { classes = 8 };  // 8K .. 1M
+
+	static int class_of(size_t size);
+
+	vector<char*>   free_list[classes];
+	buf_pool_stats  stats;
+};
+
+#endif
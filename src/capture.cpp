@@ -0,0 +1,189 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "capture.h"
+#include "http_request.h"
+#include "config.h"
+#include "utils.h"
+#include "trace.h"
+
+//
+static const char     cap_magic[8] = { 'n', 'b', '-', 'c', 'a', 'p', 't', 'r' };
+static const uint32_t cap_version  = 1;
+
+static const size_t   cap_flush_at = 256*1024;
+
+static_assert(sizeof(cap_header) == 64, "cap_header is not 64 bytes");
+static_assert(sizeof(cap_record) == 24, "cap_record is not 24 bytes");
+
+static HANDLE    cap_file = INVALID_HANDLE_VALUE;
+static uint64_t  cap_base;   // get_usec() at cap_header::started
+static string    cap_buf;
+
+//
+static void cap_put(uint16_t kind, uint32_t conn, uint16_t flags, const char * data, size_t len)
+{
+	cap_record r = { 0 };
+
+	if (cap_file == INVALID_HANDLE_VALUE)
+		return;
+
+	r.time  = get_usec() - cap_base;
+	r.conn  = conn;
+	r.len   = (uint32_t)len;
+	r.kind  = kind;
+	r.flags = flags;
+
+	cap_buf.append((char*)&r, sizeof r);
+	cap_buf.append(data, len);
+
+	if (cap_buf.size() >= cap_flush_at)
+		flush_capture();
+}
+
+/*
+ *
+ */
+bool open_capture()
+{
+	cap_header    head = { 0 };
+	LARGE_INTEGER size;
+	FILETIME      ft;
+	uint64_t      now;
+	DWORD         bytes = 0;
+
+	__enforce(cap_file == INVALID_HANDLE_VALUE);
+
+	if (conf.capture.empty())
+		return true; // off
+
+	cap_file = CreateFile(conf.capture.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+	                      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (cap_file == INVALID_HANDLE_VALUE)
+		return api_error("CreateFile", "%s", to_utf8(conf.capture).c_str());
+
+	GetSystemTimeAsFileTime(&ft);
+	now = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+
+	if (! GetFileSizeEx(cap_file, &size))
+	{
+		api_error("GetFileSizeEx", "%s", to_utf8(conf.capture).c_str());
+		goto err;
+	}
+
+	// appended to if it's a capture already
+
+	if (size.QuadPart)
+	{
+		if (! ReadFile(cap_file, &head, sizeof head, &bytes, NULL) || bytes != sizeof head ||
+		    memcmp(head.magic, cap_magic, sizeof cap_magic) ||
+		    head.version != cap_version ||
+		    head.rec_size != sizeof(cap_record))
+		{
+			trace_e("%s is not a capture or it's of an unknown version\n", to_utf8(conf.capture).c_str());
+			goto err;
+		}
+
+		SetFilePointer(cap_file, 0, NULL, FILE_END);
+	}
+	else
+	{
+		memcpy(head.magic, cap_magic, sizeof cap_magic);
+		head.version  = cap_version;
+		head.rec_size = sizeof(cap_record);
+		head.started  = now;
+
+		if (! WriteFile(cap_file, &head, sizeof head, &bytes, NULL) || bytes != sizeof head)
+		{
+			api_error("WriteFile", "%s", to_utf8(conf.capture).c_str());
+			goto err;
+		}
+	}
+
+	cap_base = get_usec() - (now - head.started) / 10;
+
+	trace_i("Capturing requests to %s%s\n", to_utf8(conf.capture).c_str(), conf.capture_hash ? ", tokens hashed" : "");
+
+	cap_put(cap_start, 0, conf.capture_hash ? cap_hashed : 0, (char*)&now, sizeof now);
+	return true;
+
+err:
+	CloseHandle(cap_file);
+	cap_file = INVALID_HANDLE_VALUE;
+	return false;
+}
+
+void close_capture()
+{
+	if (cap_file == INVALID_HANDLE_VALUE)
+		return;
+
+	flush_capture();
+
+	CloseHandle(cap_file);
+	cap_file = INVALID_HANDLE_VALUE;
+}
+
+void flush_capture()
+{
+	DWORD bytes = 0;
+
+	if (cap_file == INVALID_HANDLE_VALUE || cap_buf.empty())
+		return;
+
+	if (! WriteFile(cap_file, cap_buf.data(), (dword)cap_buf.size(), &bytes, NULL) || bytes != cap_buf.size())
+	{
+		api_error("WriteFile", "%s", to_utf8(conf.capture).c_str());
+		trace_e("Request capture stopped\n");
+
+		CloseHandle(cap_file);
+		cap_file = INVALID_HANDLE_VALUE;
+	}
+
+	cap_buf.clear();
+}
+
+//
+void cap_open_conn(uint32_t conn)
+{
+	cap_put(cap_open, conn, 0, NULL, 0);
+}
+
+void cap_close_conn(uint32_t conn)
+{
+	cap_put(cap_close, conn, 0, NULL, 0);
+}
+
+void cap_request(uint32_t conn, const http_req & req, const char * head, size_t len)
+{
+	http_hdr * auth = req.known[hh_x_access_token];
+	string     tmp;
+
+	if (cap_file == INVALID_HANDLE_VALUE)
+		return;
+
+	if (! conf.capture_hash || ! auth)
+		return cap_put(cap_head, conn, 0, head, len);
+
+	// the value is a view into 'head', and it's replaced by the same
+	// hash the area lookup uses, so that a replay can be run against
+	// an area set up with the hash for its token
+
+	tmp.assign(head, auth->value.data - head);
+	tmp += stringf("%016I64x", hash_token(auth->value.data, auth->value.size));
+	tmp.append(auth->value.data + auth->value.size, head + len - auth->value.data - auth->value.size);
+
+	cap_put(cap_head, conn, cap_hashed, tmp.data(), tmp.size());
+}
+
+void cap_payload(uint32_t conn, const char * data, size_t len)
+{
+	if (len)
+		cap_put(cap_body, conn, 0, data, len);
+}
@@ -0,0 +1,72 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "types.h"
+
+/*
+ *	Traffic capture, off unless asked for with "-t <file>". The
+ *	inbound requests are appended to the file as they come in -
+ *	the head of each, as is, and its body, as read off the wire,
+ *	before it's decoded - tagged with the connection serial and
+ *	the time. With "-T <file>" the access tokens are replaced by
+ *	their hashes.
+ *
+ *	The capture is written by the engine thread alone, through a
+ *	buffer that is flushed when it fills up and when idle.
+ *
+ *	The file is fed back to an agent by bench/replay.cpp.
+ */
+enum
+{
+	cap_start,    // a run of the agent, data: FILETIME, flags: cap_hashed
+	cap_open,     // a connection
+	cap_head,     // data: request line and headers, incl. the \r\n\r\n
+	cap_body,     // data: a piece of the body
+	cap_close,
+};
+
+enum
+{
+	cap_hashed = 0x01,   // X-Access-Token values are hashes
+};
+
+struct cap_header  // 64 bytes
+{
+	char      magic[8];   // "nb-captr"
+	uint32_t  version;
+	uint32_t  rec_size;
+	uint64_t  started;    // FILETIME, cap_record::time is from here
+	uint8_t   reserved[40];
+};
+
+struct cap_record  // 24 bytes, followed by 'len' bytes of data
+{
+	uint64_t  time;       // usec
+	uint32_t  conn;       // serial, restarts with each cap_start
+	uint32_t  len;
+	uint16_t  kind;       // cap_xxx
+	uint16_t  flags;
+	uint32_t  reserved;
+};
+
+struct http_req;
+
+//
+bool open_capture();    // if conf.capture is set
+void close_capture();
+void flush_capture();
+
+void cap_open_conn(uint32_t conn);
+void cap_close_conn(uint32_t conn);
+void cap_request(uint32_t conn, const http_req & req, const char * head, size_t len);
+void cap_payload(uint32_t conn, const char * data, size_t len);
+
+#endif
@@ -6,6 +6,7 @@
  *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
  *	All rights reserved.
  */
+#include "simd.h"
 #include "ch_range.h"
 #include "utils.h"
 
@@ -40,39 +41,62 @@ bool ch_range::is_decimal() const
 	return true;
 }
 
-char * ch_range::find(char what, size_t offset) const
+/*
+ *	Same as is_decimal() plus a check that the value fits, done
+ *	against max/10 and max%10 so that there's no division in the
+ *	loop.
+ */
+template <class T>
+static bool parse_uint(const char * data, size_t size, T & val)
 {
-	if (offset >= size)
-		return NULL;
+	const T max_10  = T(~T(0)) / 10;
+	const T max_mod = T(~T(0)) % 10;
+	T       r = 0;
 
-	what = tolower(what);
+	if (! size)
+		return false;
 
-	auto upto = data + size;
+	for (size_t i=0; i<size; i++)
+	{
+		T d = (uint8_t)data[i] - (uint8_t)'0';
 
-	for (auto p = data + offset; p < upto; p++)
-		if (tolower(*p) == what)
-			return p;
+		if (d > 9)
+			return false;
 
-	return NULL;
+		if (r > max_10 || (r == max_10 && d > max_mod))
+			return false;
+
+		r = r * 10 + d;
+	}
+
+	val = r;
+	return true;
 }
 
-char * ch_range::find(const ch_range & what, size_t offset) const
+bool ch_range::to_u32(uint32_t & val) const
 {
-	if (! what.size || offset + what.size > size)
-		return NULL;
+	return parse_uint(data, size, val);
+}
 
-	auto upto = data + size - what.size + 1;
+bool ch_range::to_u64(uint64_t & val) const
+{
+	return parse_uint(data, size, val);
+}
 
-	for (auto p = data + offset; p < upto; p++)
-	{
-		if (*p != *what.data)
-			continue;
+char * ch_range::find(char what, size_t offset) const
+{
+	if (offset >= size)
+		return NULL;
 
-		if (! _strnicmp(p, what.data, what.size))
-			return p;
-	}
+	return ch_find_char(data + offset, size - offset, what);
+}
 
-	return NULL;
+char * ch_range::find(const ch_range & what, size_t offset) const
+{
+	if (! what.size || offset + what.size > size)
+		return NULL;
+
+	return ch_find_str(data + offset, size - offset, what.data, what.size);
 }
 
 char * ch_range::find_first_of(const ch_range & what, size_t offset) const
@@ -121,7 +145,7 @@ bool ch_range::trim_r(const ch_range & what)
 
 bool ch_range::trim(const ch_range & what)
 {
-	return trim_l() ? true : trim_r();
+	return trim_l(what) ? true : trim_r(what);
 }
 
 bool ch_range::split_with(const ch_range & sep, ch_range & tail)
@@ -185,34 +209,15 @@ bool ch_range::get_line(ch_range & line)
 //
 void ch_range::tokenize(const ch_range & sep, ch_range_vec & out, bool relaxed) const
 {
-	ch_range in = *this;
-	ch_range tok;
-	auto end = in.data + in.size;
-
 	out.clear();
 
-	for (;;)
-	{
-		if (in.empty() && relaxed)
-			break;
-
-		auto eot = in.find(sep);
-
-		if (! eot)
-		{
-			out.push_back(in);
-			break;
-		}
-
-		tok.data = in.data;
-		tok.size = eot - in.data;
-
-		if (tok.size || ! relaxed)
-			out.push_back(tok);
+	for (auto & tok : tokens(sep, relaxed))
+		out.push_back(tok);
+}
 
-		in.data = eot + sep.size;
-		in.size = end - in.data;
-	}
+ch_range_tokens ch_range::tokens(const ch_range & sep, bool relaxed) const
+{
+	return ch_range_tokens(*this, sep, relaxed);
 }
 
 bool ch_range::split(const ch_range & sep, ch_range & l, ch_range & r) const
@@ -289,3 +294,280 @@ wstring ch_range::to_wstr() const
 {
 	return ::to_wstr(data, size);
 }
+
+/*
+ *	ch_range_tokens
+ */
+ch_range_tokens::ch_range_tokens(const ch_range & _in, const ch_range & _sep, bool _relaxed)
+{
+	rest = _in;
+	sep = _sep;
+	relaxed = _relaxed;
+	over = false;
+}
+
+bool ch_range_tokens::next(ch_range & tok)
+{
+	char * eot;
+
+	while (! over)
+	{
+		if (rest.empty() && relaxed)
+			break;
+
+		eot = rest.find(sep);
+
+		if (! eot)
+		{
+			tok = rest;
+			over = true;
+			return true;
+		}
+
+		tok.data = rest.data;
+		tok.size = eot - rest.data;
+
+		rest.advance_to(eot + sep.size);
+
+		if (tok.size || ! relaxed)
+			return true;
+	}
+
+	over = true;
+	return false;
+}
+
+/*
+ *	find kernels
+ *
+ *	The single char search is case-insensitive. The string search
+ *	matches the first byte exactly and the rest case-insensitively,
+ *	so the SIMD variants compare the first byte as is and the last
+ *	one with the case folded, and then verify the bytes in between
+ *	for each candidate position that passes both.
+ *
+ *	Case folding is ASCII-only, which is what tolower() and
+ *	_strnicmp() do in the "C" locale.
+ */
+static inline
+char fold(char ch)
+{
+	return ('A' <= ch && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+static inline
+bool is_letter(char ch)
+{
+	ch |= 0x20;
+	return 'a' <= ch && ch <= 'z';
+}
+
+static inline
+bool match_folded(const char * a, const char * b, size_t n)
+{
+	for (size_t i=0; i<n; i++)
+		if (a[i] != b[i] && fold(a[i]) != fold(b[i]))
+			return false;
+
+	return true;
+}
+
+/*
+ *	A letter matches in either case if its 0x20 bit is set on both
+ *	sides, and anything else needs to match exactly.
+ */
+struct byte_probe
+{
+	char val;  // folded
+	char bit;  // 0x20 for letters, 0 otherwise
+
+	byte_probe(char ch, bool folded)
+	{
+		bit = (folded && is_letter(ch)) ? 0x20 : 0;
+		val = ch | bit;
+	}
+};
+
+//
+char * ch_find_char_scalar(const char * buf, size_t len, char what)
+{
+	byte_probe probe(what, true);
+
+	for (auto end = buf + len; buf < end; buf++)
+		if ((*buf | probe.bit) == probe.val)
+			return (char*)buf;
+
+	return NULL;
+}
+
+char * ch_find_str_scalar(const char * buf, size_t len, const char * what, size_t n)
+{
+	__enforce(n);
+
+	if (n > len)
+		return NULL;
+
+	byte_probe last(what[n-1], true);
+	size_t mid = (n > 2) ? n-2 : 0;
+
+	for (auto upto = buf + len - n + 1; buf < upto; buf++)
+	{
+		if (*buf != *what || (buf[n-1] | last.bit) != last.val)
+			continue;
+
+		if (match_folded(buf+1, what+1, mid))
+			return (char*)buf;
+	}
+
+	return NULL;
+}
+
+#ifdef HAS_X86_SIMD
+
+char * ch_find_char_sse2(const char * buf, size_t len, char what)
+{
+	byte_probe probe(what, true);
+
+	const __m128i val = _mm_set1_epi8(probe.val);
+	const __m128i bit = _mm_set1_epi8(probe.bit);
+	const char  * end = buf + len;
+
+	for ( ; end - buf >= 16; buf += 16)
+	{
+		__m128i  v = _mm_or_si128(_mm_loadu_si128((const __m128i*)buf), bit);
+		uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, val));
+
+		if (m)
+			return (char*)buf + ctz32(m);
+	}
+
+	return ch_find_char_scalar(buf, end - buf, what);
+}
+
+char * ch_find_str_sse2(const char * buf, size_t len, const char * what, size_t n)
+{
+	__enforce(n);
+
+	if (n > len)
+		return NULL;
+
+	byte_probe last(what[n-1], true);
+	size_t mid = (n > 2) ? n-2 : 0;
+
+	const __m128i first = _mm_set1_epi8(*what);
+	const __m128i val   = _mm_set1_epi8(last.val);
+	const __m128i bit   = _mm_set1_epi8(last.bit);
+	const char  * upto  = buf + len - n + 1; // past the last candidate
+
+	for ( ; upto - buf >= 16; buf += 16)
+	{
+		__m128i  a = _mm_loadu_si128((const __m128i*)buf);
+		__m128i  b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(buf + n-1)), bit);
+		uint32_t m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, val)));
+
+		for ( ; m; m &= m-1)
+		{
+			auto p = buf + ctz32(m);
+			if (match_folded(p+1, what+1, mid))
+				return (char*)p;
+		}
+	}
+
+	return ch_find_str_scalar(buf, upto - buf + n-1, what, n);
+}
+
+__target_avx2
+char * ch_find_char_avx2(const char * buf, size_t len, char what)
+{
+	byte_probe probe(what, true);
+
+	const __m256i val = _mm256_set1_epi8(probe.val);
+	const __m256i bit = _mm256_set1_epi8(probe.bit);
+	const char  * end = buf + len;
+
+	for ( ; end - buf >= 32; buf += 32)
+	{
+		__m256i  v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)buf), bit);
+		uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, val));
+
+		if (m)
+			return (char*)buf + ctz32(m);
+	}
+
+	return ch_find_char_sse2(buf, end - buf, what);
+}
+
+__target_avx2
+char * ch_find_str_avx2(const char * buf, size_t len, const char * what, size_t n)
+{
+	__enforce(n);
+
+	if (n > len)
+		return NULL;
+
+	byte_probe last(what[n-1], true);
+	size_t mid = (n > 2) ? n-2 : 0;
+
+	const __m256i first = _mm256_set1_epi8(*what);
+	const __m256i val   = _mm256_set1_epi8(last.val);
+	const __m256i bit   = _mm256_set1_epi8(last.bit);
+	const char  * upto  = buf + len - n + 1;
+
+	for ( ; upto - buf >= 32; buf += 32)
+	{
+		__m256i  a = _mm256_loadu_si256((const __m256i*)buf);
+		__m256i  b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(buf + n-1)), bit);
+		uint32_t m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, val)));
+
+		for ( ; m; m &= m-1)
+		{
+			auto p = buf + ctz32(m);
+			if (match_folded(p+1, what+1, mid))
+				return (char*)p;
+		}
+	}
+
+	return ch_find_str_sse2(buf, upto - buf + n-1, what, n);
+}
+
+#else
+
+char * ch_find_char_sse2(const char * buf, size_t len, char what) { return ch_find_char_scalar(buf, len, what); }
+char * ch_find_char_avx2(const char * buf, size_t len, char what) { return ch_find_char_scalar(buf, len, what); }
+
+char * ch_find_str_sse2(const char * buf, size_t len, const char * what, size_t n) { return ch_find_str_scalar(buf, len, what, n); }
+char * ch_find_str_avx2(const char * buf, size_t len, const char * what, size_t n) { return ch_find_str_scalar(buf, len, what, n); }
+
+#endif
+
+/*
+ *
+ */
+typedef char * (* ch_find_char_fn)(const char * buf, size_t len, char what);
+typedef char * (* ch_find_str_fn)(const char * buf, size_t len, const char * what, size_t n);
+
+static ch_find_char_fn pick_find_char()
+{
+	if (cpu_has_avx2()) return ch_find_char_avx2;
+	if (cpu_has_sse2()) return ch_find_char_sse2;
+	return ch_find_char_scalar;
+}
+
+static ch_find_str_fn pick_find_str()
+{
+	if (cpu_has_avx2()) return ch_find_str_avx2;
+	if (cpu_has_sse2()) return ch_find_str_sse2;
+	return ch_find_str_scalar;
+}
+
+char * ch_find_char(const char * buf, size_t len, char what)
+{
+	static const ch_find_char_fn fn = pick_find_char();
+	return fn(buf, len, what);
+}
+
+char * ch_find_str(const char * buf, size_t len, const char * what, size_t n)
+{
+	static const ch_find_str_fn fn = pick_find_str();
+	return fn(buf, len, what, n);
+}
@@ -12,6 +12,8 @@
 #include "types.h"
 #include "enforce.h"
 
+struct ch_range_tokens;
+
 struct ch_range
 {
 	char  * data;
@@ -22,12 +24,19 @@ struct ch_range
 	ch_range(char * _data, size_t _size) { size = _size;         data = _data;                  }
 	ch_range(string & _str)              { size = _str.size();   data = size ? &_str[0] : NULL; }
 
+	// literals, which are never written through
+	ch_range(const char * _data)               { size = strlen(_data); data = (char*)_data; }
+	ch_range(const char * _data, size_t _size) { size = _size;         data = (char*)_data; }
+
 	//
 	bool empty() const;
 	bool match(const ch_range & what) const;
 
 	bool is_decimal() const;
 
+	bool to_u32(uint32_t & val) const; // decimal digits only, false on overflow
+	bool to_u64(uint64_t & val) const;
+
 	char * find(char what, size_t offset = 0) const;
 	char * find(const ch_range & what, size_t offset = 0) const;
 
@@ -49,6 +58,7 @@ struct ch_range
 
 	//
 	void tokenize(const ch_range & sep, vector<ch_range> & out, bool relaxed) const;
+	ch_range_tokens tokens(const ch_range & sep, bool relaxed) const;
 	bool split(const ch_range & sep, ch_range & left, ch_range & right) const;
 	bool split_alt(const ch_range & sep_set, ch_range & left, ch_range & right) const;
 
@@ -66,6 +76,52 @@ struct ch_range
 
 typedef vector<ch_range> ch_range_vec;
 
+/*
+ *	What find() runs on, picked at run-time. ch_find_str() needs
+ *	a non-empty needle. The variants are exposed for testing.
+ */
+char * ch_find_char(const char * buf, size_t len, char what);
+char * ch_find_str(const char * buf, size_t len, const char * what, size_t n);
+
+char * ch_find_char_scalar(const char * buf, size_t len, char what);
+char * ch_find_char_sse2(const char * buf, size_t len, char what);
+char * ch_find_char_avx2(const char * buf, size_t len, char what);
+
+char * ch_find_str_scalar(const char * buf, size_t len, const char * what, size_t n);
+char * ch_find_str_sse2(const char * buf, size_t len, const char * what, size_t n);
+char * ch_find_str_avx2(const char * buf, size_t len, const char * what, size_t n);
+
+/*
+ *	The lazy version of tokenize(), yields the same tokens one at
+ *	a time, either via next() or in a range-for. Tokens are views
+ *	into the original range, same as with tokenize().
+ */
+struct ch_range_tokens
+{
+	ch_range_tokens(const ch_range & in, const ch_range & sep, bool relaxed);
+
+	bool next(ch_range & tok);
+
+	struct iterator
+	{
+		ch_range_tokens * src;
+		ch_range          tok;
+
+		ch_range & operator * ()  { return tok; }
+		iterator & operator ++ () { if (! src->next(tok)) src = NULL; return *this; }
+		bool operator != (const iterator & x) const { return src != x.src; }
+	};
+
+	iterator begin() { iterator it = { this, ch_range() }; return ++it; }
+	iterator end()   { iterator it = { NULL, ch_range() }; return it;   }
+
+private:
+	ch_range  rest;
+	ch_range  sep;
+	bool      relaxed;
+	bool      over;
+};
+
 //
 #define __str(x)   (x).size, (x).data
 
@@ -0,0 +1,191 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "coalesce.h"
+#include "config.h"
+#include "utils.h"
+#include "trace.h"
+
+//
+static const uint_t max_tries = 3; // per revision
+
+static wstring board_key(const wstring & area, const string & board)
+{
+	return area + L"\\" + to_wstr(board);
+}
+
+static void drop_temp(const wstring & area, const wstring & temp)
+{
+	wstring file;
+
+	if (temp.empty())
+		return;
+
+	file = conf.path + L"\\" + area + L"\\" + temp;
+
+	if (! DeleteFile(file.c_str()))
+		trace_e("DeleteFile() failed %lu, [%S]\n", GetLastError(), file.c_str());
+}
+
+/*
+ *
+ */
+void coalescer::hold(const wstring & area, uint_t window, const string & board, uint_t rev,
+                     const string & meta, const ch_range & data, const wstring & temp)
+{
+	co_board & b = boards[ board_key(area, board) ];
+	uint64_t   now = get_usec();
+
+	b.area   = area;
+	b.board  = board;
+	b.window = (uint64_t)window * 1000000;
+
+	stats.saves++;
+
+	// a save with no board data only updates the meta
+
+	if (b.held && ! data.size && temp.empty())
+	{
+		b.held->meta = meta;
+		b.held->last = now;
+		return;
+	}
+
+	if (b.held)
+	{
+		trace_v("Board %s, revision %u is superseded by %u\n", board.c_str(), b.held->rev, rev);
+
+		drop_temp(area, b.held->temp);
+		stats.superseded++;
+	}
+	else
+	{
+		b.held.reset(new co_rev);
+		b.held->first = now;
+		stats.held++;
+	}
+
+	co_rev & r = *b.held;
+
+	r.rev   = rev;
+	r.tries = 0;
+	r.meta = meta;
+	r.data.assign(data.data, data.size);
+	r.temp = temp;
+	r.last = now;
+}
+
+bool coalescer::drop(const wstring & area, const string & board)
+{
+	auto i = boards.find( board_key(area, board) );
+
+	if (i == boards.end() || ! i->second.held)
+		return false;
+
+	trace_v("Board %s, revision %u is dropped\n", board.c_str(), i->second.held->rev);
+
+	drop_temp(area, i->second.held->temp);
+	i->second.held.reset();
+	stats.held--;
+
+	if (! i->second.writing)
+		boards.erase(i);
+
+	return true;
+}
+
+bool coalescer::flush(store_pool & pool, bool all)
+{
+	uint64_t now = get_usec();
+	uint64_t checkpoint = (uint64_t)conf.checkpoint * 1000000;
+
+	for (auto & x : boards)
+	{
+		co_board & b = x.second;
+
+		if (! b.held || b.writing)
+			continue;
+
+		if (! all && now - b.held->last < b.window && now - b.held->first < checkpoint)
+			continue;
+
+		b.writing = std::move(b.held);
+		stats.held--;
+		stats.writes++;
+
+		co_rev    & r = *b.writing;
+		store_job & job = r.job;
+
+		trace_v("Board %s, revision %u is written, %llu ms after it came in\n",
+			b.board.c_str(), r.rev, (now - r.last) / 1000);
+
+		job = store_job();
+
+		job.type  = store_job::put_board;
+		job.area  = b.area;
+		job.board = b.board;
+		job.rev   = r.rev;
+		job.meta  = ch_range(r.meta);
+		job.data  = ch_range(r.data);
+		job.temp  = r.temp;
+		job.owner = this;
+		job.route = "PUT /board";
+
+		pool.submit(&job);
+	}
+
+	return ! boards.empty();
+}
+
+void coalescer::on_stored(store_job & job)
+{
+	auto i = boards.find( board_key(job.area, job.board) );
+
+	__enforce(i != boards.end());
+
+	co_board & b = i->second;
+
+	__enforce(b.writing && &b.writing->job == &job);
+
+	// the client's been told it's saved, so it's retried after
+	// another window unless a newer revision came in meanwhile
+
+	if (! job.ok)
+	{
+		co_rev & r = *b.writing;
+
+		if (! b.held && ++r.tries < max_tries)
+		{
+			trace_e("Board %s, revision %u is not written, will retry - %s\n", b.board.c_str(), r.rev, job.error);
+
+			r.first = r.last = get_usec();
+			b.held = std::move(b.writing);
+			stats.held++;
+			stats.retried++;
+			return;
+		}
+
+		if (b.held)
+			trace_e("Board %s, revision %u is not written, superseded by %u - %s\n", b.board.c_str(), r.rev, b.held->rev, job.error);
+		else
+			trace_e("Board %s, revision %u is lost - %s\n", b.board.c_str(), r.rev, job.error);
+
+		drop_temp(b.area, r.temp);
+		stats.failed++;
+	}
+
+	b.writing.reset();
+
+	if (! b.held)
+		boards.erase(i);
+}
+
+void coalescer::get_stats(co_stats & out)
+{
+	out = stats;
+}
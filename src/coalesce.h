@@ -0,0 +1,86 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _COALESCE_H_
+#define _COALESCE_H_
+
+#include "types.h"
+#include "storage.h"
+
+#include <memory>
+
+/*
+ *	Board saves held in memory for areas with a coalescing window.
+ *	Nullboard saves a board on nearly every pause in typing, so a
+ *	revision is held until the board goes quiet for the window and
+ *	a newer one just takes its place. Held revisions are written
+ *	at least every conf.checkpoint seconds, and all of them when
+ *	the engine stops. A revision that fails to be written is held
+ *	again, unless there's a newer one, and retried a few times.
+ *
+ *	Used by the engine thread alone. The writes go through the
+ *	store pool, one at a time per board, with the jobs' 'owner'
+ *	pointing at the coalescer.
+ */
+struct co_rev
+{
+	uint_t     rev;
+	string     meta;
+	string     data;     // the last piece of it, if there's a temp
+	wstring    temp;     // in the area folder, with the rest of the data
+	uint64_t   first;    // usec, the oldest revision not yet written came in
+	uint64_t   last;     // ... the newest
+	uint_t     tries;    // failed writes
+	store_job  job;      // while being written
+};
+
+struct co_board
+{
+	wstring    area;     // folder
+	string     board;
+	uint64_t   window;   // usec, as of the last save
+	std::unique_ptr<co_rev>  held;
+	std::unique_ptr<co_rev>  writing;
+};
+
+struct co_stats
+{
+	size_t    held;        // boards with a revision not yet written
+	uint64_t  saves;       // taken in
+	uint64_t  superseded;  // ... and dropped for a newer one
+	uint64_t  writes;      // submitted
+	uint64_t  retried;     // failed and held again
+	uint64_t  failed;      // failed and lost
+
+	co_stats() { memset(this, 0, sizeof *this); }
+};
+
+struct coalescer
+{
+	// takes over 'temp'
+	void hold(const wstring & area, uint_t window, const string & board, uint_t rev,
+	          const string & meta, const ch_range & data, const wstring & temp);
+
+	// the board is being deleted, returns true if there was a
+	// revision held, i.e. the board may not be on disk yet
+	bool drop(const wstring & area, const string & board);
+
+	// submits the revisions that are due or, if 'all', all that can
+	// be, returns false once there's nothing held or being written
+	bool flush(store_pool & pool, bool all);
+
+	void on_stored(store_job & job);
+
+	void get_stats(co_stats & stats);
+
+private:
+	map<wstring, co_board>   boards;  // by area\board
+	co_stats                 stats;
+};
+
+#endif
@@ -11,6 +11,8 @@
 #include "utils.h"
 #include "console.h"
 
+#include <mutex>
+
 //
 app_config conf;
 
@@ -20,7 +22,8 @@ bool syntax()
 	show_console();
 	conf.console = true;
 
-	trace_i("Syntax: nullboard-agent.exe [-c <etc-path>] [-v|-vv] [-d]\n");
+	trace_i("Syntax: nullboard-agent.exe [-c <etc-path>] [-l <log-file>] [-v|-vv] [-d] [-t|-T <capture>]\n");
+	trace_i("        nullboard-agent.exe -e <event-log>\n");
 	return false;
 }
 
@@ -68,6 +71,38 @@ bool parse_args(int argc, wchar_t ** argv)
 			continue;
 		}
 
+		if (! wcscmp(argv[i], L"-l"))
+		{
+			if (++i == argc)
+				return syntax();
+
+			conf.trace_file = argv[i];
+			trace_v("conf.trace_file: [%s]\n", to_utf8(conf.trace_file).c_str());
+			continue;
+		}
+
+		if (! wcscmp(argv[i], L"-e"))
+		{
+			if (++i == argc)
+				return syntax();
+
+			conf.event_dump = argv[i];
+			trace_v("conf.event_dump: [%s]\n", to_utf8(conf.event_dump).c_str());
+			continue;
+		}
+
+		if (! wcscmp(argv[i], L"-t") || ! wcscmp(argv[i], L"-T"))
+		{
+			conf.capture_hash = (argv[i][1] == L'T');
+
+			if (++i == argc)
+				return syntax();
+
+			conf.capture = argv[i];
+			trace_v("conf.capture: [%s], hashed tokens %u\n", to_utf8(conf.capture).c_str(), conf.capture_hash);
+			continue;
+		}
+
 //		if (! wcscmp(argv[i], L"-a"))
 //		{
 //			if (++i == argc)
@@ -130,7 +165,7 @@ bool load_ini()
 
 		if (k.match("trace"))
 		{
-			if (! v.scanf("%u", &conf.trace) || conf.trace < 2)
+			if (! v.to_u32(conf.trace) || conf.trace < 2)
 				goto malformed;
 
 			trace_v("conf.trace: level %u\n", conf.trace);
@@ -148,16 +183,22 @@ bool load_ini()
 		if (k.match("area"))
 		{
 			vector<ch_range> parts;
+			uint_t coalesce = 0;
 
 			v.tokenize("|", parts, false);
 
-			if (parts.size() != 3 || parts[0].empty() || parts[1].empty())
+			// token|folder|page, optionally followed by |coalesce
+
+			if (parts.size() < 3 || parts.size() > 4 || parts[0].empty() || parts[1].empty())
+				goto malformed;
+
+			if (parts.size() == 4 && (! parts[3].to_u32(coalesce) || coalesce > 3600))
 				goto malformed;
 
-			conf.areas[ parts[0].to_str() ] = { parts[1].to_wstr(), parts[2].to_wstr() };
+			conf.areas[ parts[0].to_str() ] = area_ref(new area_info{ parts[1].to_wstr(), parts[2].to_wstr(), coalesce });
 
-			trace_v("conf.area: token [%.*s], folder [%.*s], page [%.*s]\n",
-				__str(parts[0]), __str(parts[1]), __str(parts[2]));
+			trace_v("conf.area: token [%.*s], folder [%.*s], page [%.*s], coalesce %u s\n",
+				__str(parts[0]), __str(parts[1]), __str(parts[2]), coalesce);
 			continue;
 		}
 
@@ -185,6 +226,40 @@ bool load_ini()
 			continue;
 		}
 
+		if (k.match("conn_buf_kb"))
+		{
+			uint_t kb;
+
+			// 64 KB is the request header cap
+			if (! v.to_u32(kb) || kb < 64 || kb > 1024*1024)
+				goto malformed;
+
+			conf.conn_buf = (size_t)kb * 1024;
+			trace_v("conf.conn_buf: %u KB\n", kb);
+			continue;
+		}
+
+		if (k.match("event_log_mb"))
+		{
+			uint_t mb;
+
+			if (! v.to_u32(mb) || mb > 1024)
+				goto malformed;
+
+			conf.event_log = (size_t)mb * 1024 * 1024;
+			trace_v("conf.event_log: %u MB\n", mb);
+			continue;
+		}
+
+		if (k.match("checkpoint_s"))
+		{
+			if (! v.to_u32(conf.checkpoint) || ! conf.checkpoint)
+				goto malformed;
+
+			trace_v("conf.checkpoint: %u s\n", conf.checkpoint);
+			continue;
+		}
+
 		trace_v("Unknown \"%.*s\" entry in line %d in %s\n",
 			__str(k), line_i, to_utf8(file).c_str());
 		continue;
@@ -195,12 +270,11 @@ malformed:
 		return false;
 	}
 
+	index_areas();
 	return true;
 }
 
 //
-string stringf(const char * format, ...); // import from libp
-
 static string key_str(const char * str, size_t min_len = 20)
 {
 	string x = str;
@@ -211,20 +285,193 @@ static string key_str(const char * str, size_t min_len = 20)
 	return x;
 }
 
+static std::mutex area_lock; // see area_table
+static std::mutex ini_lock;  // the UI and the storage pool both save the ini
+
 bool save_ini()
 {
 	wstring  file = conf.path + L"\\settings.ini";
 	string   text;
 
-	text += key_str("trace")     + stringf("%u\r\n", conf.trace);
-	text += key_str("console")   + stringf("%u\r\n", conf.console);
-	text += key_str("listen")    + sa_to_str(conf.addr, conf.port) + "\r\n";
-	text += key_str("say_hello") + stringf("%u\r\n", conf.say_hello);
+	std::lock_guard<std::mutex> lock(ini_lock);
+
+	text += key_str("trace")       + stringf("%u\r\n", conf.trace);
+	text += key_str("console")     + stringf("%u\r\n", conf.console);
+	text += key_str("listen")      + sa_to_str(conf.addr, conf.port) + "\r\n";
+	text += key_str("say_hello")   + stringf("%u\r\n", conf.say_hello);
+	text += key_str("conn_buf_kb") + stringf("%u\r\n", (uint_t)(conf.conn_buf / 1024));
+	text += key_str("event_log_mb") + stringf("%u\r\n", (uint_t)(conf.event_log / 1024 / 1024));
+	text += key_str("checkpoint_s") + stringf("%u\r\n", conf.checkpoint);
 
 	text += "\r\n";
 
-	for (auto & a : conf.areas)
-		text += key_str("area") + a.first + "|" + to_utf8(a.second.folder) + "|" + to_utf8(a.second.url) + "\r\n";
+	{
+		std::lock_guard<std::mutex> lock(area_lock);
+
+		for (auto & a : conf.areas)
+		{
+			text += key_str("area") + a.first + "|" + to_utf8(a.second->folder) + "|" + to_utf8(a.second->url);
+
+			if (a.second->coalesce)
+				text += stringf("|%u", a.second->coalesce);
+
+			text += "\r\n";
+		}
+	}
 
 	return save_file(file, text);
 }
+
+/*
+ *	Access tokens are looked up in an open-addressed hash table,
+ *	keyed by a hash of the lower-cased token, since the tokens
+ *	are matched case-insensitively. The candidate with the same
+ *	hash is then compared in full, in time that doesn't depend
+ *	on where it differs from the token.
+ *
+ *	The table is rebuilt on changes and swapped in under a lock,
+ *	as it's read by the engine thread and changed by the UI one.
+ *	The map is changed under the same lock, after the table, and
+ *	the table has copies of the tokens and references to areas,
+ *	nothing in it points into the map.
+ */
+struct area_slot
+{
+	uint64_t   hash;
+	string     token;  // empty if the slot is free
+	area_ref   area;
+};
+
+static vector<area_slot>  area_table;  // power of 2, at most half full
+
+static inline uint8_t fold(uint8_t ch) // branchless, as it sees the tokens
+{
+	return ch | ((uint8_t)(ch - 'A') < 26) << 5;
+}
+
+uint64_t hash_token(const char * data, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+
+	for (size_t i=0; i<size; i++)
+	{
+		h ^= fold(data[i]);
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+static bool same_token(const string & token, const ch_range & what)
+{
+	size_t  n = token.size();
+	uint8_t diff = (what.size != n);
+
+	// always n rounds, whatever 'what' is
+
+	for (size_t i=0; i<n; i++)
+	{
+		uint8_t a = fold(token[i]);
+		uint8_t b = fold(i < what.size ? what.data[i] : 0);
+		diff |= a ^ b;
+	}
+
+	return ! diff;
+}
+
+static void make_table(const string * skip, vector<area_slot> & table)
+{
+	size_t size = 16;
+
+	while (size < 2 * conf.areas.size())
+		size *= 2;
+
+	table.clear();
+	table.resize(size, area_slot());
+
+	for (auto & a : conf.areas)
+	{
+		uint64_t h = hash_token(a.first.data(), a.first.size());
+		size_t   i = h & (size-1);
+
+		if (skip && a.first == *skip)
+			continue;
+
+		while (table[i].area)
+			i = (i + 1) & (size-1);
+
+		table[i] = area_slot{ h, a.first, a.second };
+	}
+}
+
+void index_areas()
+{
+	vector<area_slot> table;
+
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	make_table(NULL, table);
+	area_table.swap(table);
+}
+
+void add_area(const string & token, const area_info & area)
+{
+	vector<area_slot> table;
+
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	conf.areas[token] = area_ref(new area_info(area));
+
+	make_table(NULL, table);
+	area_table.swap(table);
+}
+
+void remove_area(const string & token)
+{
+	vector<area_slot> table;
+
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	// out of the table first, the requests that have the area keep it
+
+	make_table(&token, table);
+	area_table.swap(table);
+
+	conf.areas.erase(token);
+}
+
+area_ref find_area(const ch_range & token)
+{
+	uint64_t h = hash_token(token.data, token.size);
+
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	if (area_table.empty())
+		return NULL;
+
+	size_t mask = area_table.size() - 1;
+
+	for (size_t i = h & mask; area_table[i].area; i = (i + 1) & mask)
+		if (area_table[i].hash == h && same_token(area_table[i].token, token))
+			return area_table[i].area;
+
+	return NULL;
+}
+
+bool set_area_url(const area_ref & area, const wstring & url)
+{
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	if (area->url == url)
+		return false;
+
+	area->url = url;
+	return true;
+}
+
+wstring get_area_url(const area_ref & area)
+{
+	std::lock_guard<std::mutex> lock(area_lock);
+
+	return area->url;
+}
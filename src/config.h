@@ -11,25 +11,45 @@
 
 #include "types.h"
 
+#include <memory>
+
 //
 struct area_info
 {
 	wstring  folder;
 	wstring  url;
+	uint_t   coalesce;  // sec, board saves are held in memory for this long, 0 for not
 };
 
-typedef map<string, area_info> area_map;
+/*
+ *	Areas are shared with the requests that are using them, so
+ *	that they stay put if removed in the meantime. The map is
+ *	changed by the UI thread alone, through add_area() and
+ *	remove_area(), and the url - through set_area_url().
+ */
+typedef std::shared_ptr<area_info> area_ref;
+
+typedef map<string, area_ref> area_map;
+
+struct ch_range;
 
 //
 struct app_config
 {
 	uint_t    trace;            // error (0) ... debug (4)
+	wstring   trace_file;       // console if empty
 	bool      console;
 	wstring   path;
 	uint32_t  addr;
 	uint16_t  port;
 	area_map  areas;
 	bool      say_hello;        // "up and running"
+	size_t    conn_buf;         // per-connection buffer cap, larger request bodies are streamed to disk
+	size_t    event_log;        // size of events.bin, 0 for none
+	wstring   event_dump;       // -e, print this event log and exit
+	wstring   capture;          // -t or -T, requests are captured to this file
+	bool      capture_hash;     // -T, with the access tokens hashed
+	uint_t    checkpoint;       // sec, held board saves are written at least this often
 
 	app_config()
 	{
@@ -39,6 +59,10 @@ struct app_config
 		port = 10001;
 //		areas["TestToken"] = { L"TestFolder", L"" }
 		say_hello = true;
+		conn_buf = 256*1024;
+		event_log = 16*1024*1024;
+		capture_hash = false;
+		checkpoint = 60;
 	}
 };
 
@@ -50,4 +74,13 @@ bool parse_args(int argc, wchar_t ** argv);
 bool load_ini();
 bool save_ini();
 
+void     index_areas();  // after loading conf.areas
+void     add_area(const string & token, const area_info & area);
+void     remove_area(const string & token);
+area_ref find_area(const ch_range & token);
+uint64_t hash_token(const char * data, size_t size); // FNV-1a, case-insensitive as the match is
+
+bool     set_area_url(const area_ref & area, const wstring & url); // true if changed, save_ini() is then up to the caller
+wstring  get_area_url(const area_ref & area);
+
 #endif
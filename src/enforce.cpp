@@ -15,7 +15,7 @@
 //
 static void on_enforce(const char * exp, const char * file, const char * func, int line)
 {
-	printf("assert(%s) failed, line %d, file %s\n", exp, line, file);
+	printf("assert(%s) failed in %s(), line %d, file %s\n", exp, func, line, file);
 	abort();
 }
 
@@ -12,35 +12,169 @@
 #include "utils.h"
 #include "trace.h"
 #include "config.h"
+#include "storage.h"
+#include "board_scan.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "spans.h"
+#include "capture.h"
+#include "coalesce.h"
+#include "routes.h"
+
+#include <list>
+
+//
+static_assert((int)mx_verbs == (int)vb_count && (int)mx_routes == (int)rt_count, "Out of sync with the metrics");
+
+struct en_conn : sk_conn
+{
+	enum
+	{
+		st_headers,   // reading the request line and headers
+		st_payload,   // reading the Content-Length worth of body
+		st_storing,   // waiting for the storage pool to complete the job
+		st_done,      // to be closed
+		st_sending,   // writing out a reply that didn't fit into the socket, see queue_reply()
+	};
+
+	int           state;  // see set_state()
+	uint32_t      serial; // for the event log
+	sockaddr_in   peer;
+	dword         last;   // GetTickCount() of the last i/o
+	uint_t        requests;
+	bool          keep_alive;
+	http_req      req;
+	int           verb;   // vb_xxx
+
+	// timing, usec
+	uint64_t      t_start;  // of the request, 0 if not yet
+	uint64_t      t_head;   // headers parsed
+	uint64_t      t_decode; // spent in the form reader
+	uint64_t      c_start;  // t_start, sp_clock()
+
+	// resolved from the headers, before the payload is read
+	size_t        left;   // of the Content-Length, past pos
+	size_t        cap_left; // of the Content-Length, not yet captured
+	int           route;
+	area_ref      area;   // stays put if the area is removed meanwhile
+	string        id;     // board id
+
+	// the payload, as it is being read, see on_payload()
+	form_reader   form;
+	string        meta;
+	string        self;
+	uint64_t      data_size;
+	bool          data_done;
+	board_scan    scan;   // of the board data
+	wstring       temp;   // data that didn't fit into the buf, in the area folder
+
+	store_job     job;
+
+	// the reply, if it's being sent piecemeal
+	string        out;
+	size_t        out_at;
+	int           out_code;
+	uint64_t      t_out;  // usec, queued
+	uint64_t      c_out;  // ditto, sp_clock()
+
+	en_conn() { state = st_headers; serial = 0; last = 0; requests = 0; keep_alive = false; verb = vb_other; t_start = t_head = t_decode = c_start = 0; left = 0; cap_left = 0; route = rt_none; data_size = 0; data_done = false; peer = { AF_INET }; out_at = 0; out_code = 0; t_out = c_out = 0; }
+
+	const char * route_tag() const { return route_name(route); } // for the spans
+
+	void set_state(int st)
+	{
+		ev_put(ev_conn_state, serial, st, state);
+		state = st;
+	}
+
+	void next() // moves on to the request that follows the current one
+	{
+		__enforce(state == st_headers);
+
+		discard(pos);
+		trim_buf();
+
+		last = GetTickCount();
+		req.reset();
+		verb = vb_other;
+		t_start = t_head = t_decode = c_start = 0;
+		left = 0;
+		cap_left = 0;
+		route = rt_none;
+		area.reset();
+		id.clear();
+
+		form = form_reader();
+		meta.clear();
+		self.clear();
+		data_size = 0;
+		data_done = false;
+		scan.reset();
+		temp.clear();
+	}
+};
+
+typedef std::list<en_conn> en_conn_list;
 
 //
 struct the_engine
 {
-	the_engine()  { srv = -1; enough = false; self = NULL; }
+	the_engine()  { srv = -1; enough = false; self = NULL; uploads = 0; serials = 0; ini_dirty = ini_queued = false; }
 	~the_engine() { closesocket(srv); }
 
 	bool init();
 	void run();
 	void stop();
 
-	bool recv_payload(size_t bytes);
-
-	bool send_cors_ok();
-	bool send_ok();
-
-	bool handle_api_request (http_req & req);
-	bool handle_put_test    (area_info & area, ch_range_vec & args);
-	bool handle_put_config  (area_info & area, ch_range_vec & args);
-	bool handle_put_board   (area_info & area, ch_range_vec & args, const string & id);
-	bool handle_del_board   (area_info & area, const ch_range & id);
+	bool accept_conns();
+	bool on_readable(en_conn & conn);
+	bool on_writable(en_conn & conn);
+	bool advance(en_conn & conn);
+	bool on_headers(en_conn & conn);
+	bool on_payload(en_conn & conn);
+	bool on_request(en_conn & conn, const ch_range & data);
+	void on_stored(store_job_vec & stored);
+	void on_stored(en_conn & conn);
+
+	bool send_cors_ok(en_conn & conn);
+	bool send_ok(en_conn & conn);
+
+	void update_url(en_conn & conn);
+	bool flush_ini();
+
+	bool handle_api_request (en_conn & conn);
+	bool handle_put_test    (en_conn & conn, area_info & area);
+	bool handle_put_config  (en_conn & conn, area_info & area, const ch_range & data);
+	bool handle_put_board   (en_conn & conn, area_info & area, const ch_range & data, const string & id);
+	bool handle_del_board   (en_conn & conn, area_info & area, const ch_range & id);
+	bool handle_get_metrics (en_conn & conn);
+	bool handle_get_spans   (en_conn & conn);
 
 	//
-	SOCKET   srv;
-	bool     enough;
-	sk_conn  conn;
-	HANDLE   self;
+	SOCKET        srv;
+	bool          enough;
+	en_conn_list  conns;
+	HANDLE        self;
+
+	store_pool    pool;
+	sk_waker      waker;  // poked by the pool on job completion
+	coalescer     saves;  // board saves held in memory
+	uint_t        uploads;
+	uint32_t      serials;
+
+	store_job     ini_job;     // settings.ini is saved by the pool, one save at a time
+	bool          ini_dirty;   // an area's url changed since the last save was queued
+	bool          ini_queued;
 };
 
+//
+static const size_t max_conns     = FD_SETSIZE - 1; // -1 for the srv
+static const size_t max_head_size = 64*1024;
+static const dword  io_timeout    = 2000;           // ms, per connection, mid-request
+static const dword  idle_timeout  = 15000;          // ms, between requests
+static const uint_t max_requests  = 100;            // per connection
+static const size_t store_workers = 2;
+
 /*
  *	misc
  */
@@ -62,30 +196,152 @@ static bool init_winsock()
 	return true;
 }
 
-static string nope(const char * details, int code, const char * desc)
+/*
+ *	All replies go through here, for the metrics
+ */
+static int mx_code(int code)
+{
+	switch (code)
+	{
+	case 200: return 1;
+	case 204: return 2;
+	case 400: return 3;
+	case 403: return 4;
+	case 405: return 5;
+	case 413: return 6;
+	case 500: return 7;
+	}
+
+	return 0;
+}
+
+static void on_replied(en_conn & conn, int code, size_t bytes, uint64_t t0, uint64_t c0)
+{
+	uint64_t c1 = sp_clock();
+
+	sp_put("sk_send", conn.serial, conn.route_tag(), c0, c1);
+	sp_put("request", conn.serial, conn.route_tag(), conn.c_start, c1);
+
+	mx_time(mx_response, get_usec() - t0);
+	mx_bytes_out(bytes);
+	mx_request(conn.verb, conn.route, mx_code(code));
+}
+
+/*
+ *	Sends what's left of conn.out without blocking. If the socket
+ *	doesn't take it all, the connection goes into st_sending and
+ *	the engine waits for it to become writable. Once all is sent,
+ *	the connection is back at st_headers. Returns false if the
+ *	connection is to be closed.
+ */
+static bool send_more(en_conn & conn)
+{
+	ch_range rest(&conn.out[conn.out_at], conn.out.size() - conn.out_at);
+	int rc = 0;
+
+	while (rest.size && (rc = sk_send_some(conn, rest)) > 0)
+		;
+
+	conn.out_at = conn.out.size() - rest.size;
+
+	if (rc == -1 || ! rest.size)
+	{
+		on_replied(conn, conn.out_code, conn.out_at, conn.t_out, conn.c_out);
+
+		conn.out = string(); // let go of it, it's big
+		conn.out_at = 0;
+	}
+
+	if (rc == -1)
+		return false;
+
+	if (rest.size && conn.state != en_conn::st_sending)
+		conn.set_state(en_conn::st_sending);
+
+	if (! rest.size && conn.state == en_conn::st_sending)
+		conn.set_state(en_conn::st_headers);
+
+	return true;
+}
+
+/*
+ *	All replies go out this way, the engine never blocks on a send.
+ *	Returns false if the connection is to be closed. Otherwise the
+ *	reply is either out or the connection is in st_sending, and
+ *	on_writable() takes it from there.
+ */
+static bool queue_reply(en_conn & conn, int code, string & reply)
+{
+	__enforce(conn.state != en_conn::st_sending && conn.out.empty());
+
+	conn.out.swap(reply);
+	conn.out_at = 0;
+	conn.out_code = code;
+	conn.t_out = get_usec();
+	conn.c_out = sp_clock();
+
+	return send_more(conn);
+}
+
+static void nope(en_conn & conn, const char * details, int code, const char * desc)
 {
 	string r;
-	char  why[64] = { 0 };
+	char  why[128] = { 0 };
+
+	// errors are not necessarily preceded by the payload being
+	// read in full, so the connection is always closed after them
 
-	snprintf(why, sizeof(why)-1, "HTTP/1.1 %d %s\r\n", code, desc);
+	conn.keep_alive = false;
+
+	snprintf(why, sizeof(why)-1, "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n", code, desc, strlen(details));
 
 	r = why;
 	r += "Access-Control-Allow-Origin: *\r\n"
 	     "Cache-Control: no-cache\r\n"
 	     "Content-Type: text/plain\r\n"
+	     "Connection: close\r\n"
 	     "\r\n";
+	r += details;
+
+	queue_reply(conn, code, r);
+}
+
+static void nope_400(en_conn & conn, const char * details)
+{
+	nope(conn, details, 400, "Bad request");
+}
+
+static void nope_500(en_conn & conn, const char * details)
+{
+	nope(conn, details, 500, "Internal error");
+}
 
-	return r + details;
+static const char * conn_header(const en_conn & conn)
+{
+	return conn.keep_alive ?
+		"Connection: keep-alive\r\n\r\n" :
+		"Connection: close\r\n\r\n";
 }
 
-static string nope_400(const char * details)
+
+static void drop_temp(en_conn & conn)
 {
-	return nope(details, 400, "Bad request");
+	wstring file;
+
+	if (conn.temp.empty())
+		return;
+
+	file = conf.path + L"\\" + conn.area->folder + L"\\" + conn.temp;
+
+	if (! DeleteFile(file.c_str()))
+		trace_e("DeleteFile() failed %lu, [%S]\n", GetLastError(), file.c_str());
+
+	conn.temp.clear();
 }
 
-static string nope_500(const char * details)
+static void on_store_done(void * ctx)
 {
-	return nope(details, 500, "Internal error");
+	((the_engine*)ctx)->waker.wake();
 }
 
 /*
@@ -110,7 +366,7 @@ bool the_engine::init()
 //		goto err;
 
 	addr.sin_port = htons(conf.port);
-	addr.sin_addr.S_un.S_addr = htonl(conf.addr);
+	addr.sin_addr.s_addr = htonl(conf.addr);
 
 	if (bind(srv, (sockaddr*)&addr, sizeof addr) < 0)
 	{
@@ -126,6 +382,16 @@ bool the_engine::init()
 		goto err;
 	}
 
+	if (! sk_unblock(srv))
+		goto err;
+
+	if (! waker.init())
+		goto err;
+
+	pool.start(store_workers, on_store_done, this);
+
+	open_capture(); // not fatal
+
 	trace_i("Server is up\n");
 	return true;
 
@@ -138,82 +404,152 @@ err:
 
 void the_engine::run()
 {
-	__enforce(srv != -1);
+	store_job_vec stored;
 
-	// one loop per connection
+	__enforce(srv != -1);
 
+	/*
+	 *	A single-threaded reactor - wait for any of the sockets to
+	 *	become readable, then advance each ready connection through
+	 *	its request as far as the data at hand allows.
+	 */
 	while (! enough)
 	{
-		sockaddr_in peer = { AF_INET };
-		int alen = sizeof(peer);
-		http_req req;
+		timeval tv = { 0, 250*1000 }; // to notice 'enough'
+		fd_set  rd, wr;
+		dword   now;
+		int     rc;
 
-		__enforce(conn.sk == -1);
+		FD_ZERO(&rd);
+		FD_ZERO(&wr);
+		FD_SET(waker.sk, &rd);
 
-		//
-		conn.sk = accept(srv, (sockaddr*)&peer, &alen);
-		if (conn.sk < 0)
-		{
-			wsa_error("accept");
+		if (conns.size() < max_conns)
+			FD_SET(srv, &rd);
 
-			if (sk_accept_fatal())
-				break;
+		for (auto & c : conns)
+		{
+			if (c.state == en_conn::st_headers || c.state == en_conn::st_payload)
+				FD_SET(c.sk, &rd);
+			else
+			if (c.state == en_conn::st_sending)
+				FD_SET(c.sk, &wr);
+		}
 
-			continue;
+		rc = select(0, &rd, &wr, NULL, &tv);
+		if (rc < 0)
+		{
+			wsa_error("select");
+			break;
 		}
 
-		trace_i("Connection accepted from %s\n", sa_to_str(peer).c_str());
+		if (rc == 0)
+			flush_capture(); // idle
 
-		if (! sk_unblock(conn.sk))
-			goto drop;
+		if (FD_ISSET(waker.sk, &rd))
+			waker.drain();
+
+		pool.collect(stored);
+		on_stored(stored);
 
-		conn.buf.resize(8*1024);
+		saves.flush(pool, false);
+		flush_ini();
+
+		if (FD_ISSET(srv, &rd) && ! accept_conns())
+			break;
 
-		// read HTTP request headers - ie just read up to \r\n\r\n
+		now = GetTickCount();
 
-		for (;;)
+		for (auto i = conns.begin(); i != conns.end(); )
 		{
-			int rc;
+			auto & conn = *i;
+			bool keep;
+
+			if (conn.state == en_conn::st_storing)
+				keep = true;
+			else
+			if (conn.state == en_conn::st_done)
+				keep = false;
+			else
+			if (conn.state == en_conn::st_sending && FD_ISSET(conn.sk, &wr))
+				keep = on_writable(conn);
+			else
+			if (FD_ISSET(conn.sk, &rd))
+				keep = on_readable(conn);
+			else
+			if (now - conn.last < (conn.fill ? io_timeout : idle_timeout))
+				keep = true;
+			else
+			{
+				trace_v("Connection timed out\n");
+				keep = false;
+			}
+
+			if (keep)
+			{
+				i++;
+				continue;
+			}
+
+			ev_put(ev_conn_close, conn.serial, conn.requests);
+			cap_close_conn(conn.serial);
+
+			drop_temp(conn);
+			conn.clear();
+			trace_i("Connection closed\n\n");
+
+			i = conns.erase(i);
+			on_engine_activity();
+		}
+	}
 
-			rc = sk_recv(conn, 2); // 2 seconds
-			if (rc <= 0)
-				goto drop;
+	// write out the held board saves and the ini while the pool is still up
 
-			rc = parse_http_request(conn, req);
-			if (rc < 0)
-				goto drop; // something's malformed
+	while (saves.flush(pool, true) || flush_ini())
+	{
+		timeval tv = { 0, 250*1000 };
+		fd_set  rd;
 
-			if (rc > 0)
-				break;
+		FD_ZERO(&rd);
+		FD_SET(waker.sk, &rd);
 
-			conn.replenish_buf();
-		}
+		if (select(0, &rd, NULL, NULL, &tv) > 0)
+			waker.drain();
 
-		//
-		if (req.verb.match("options"))
-		{
-			send_cors_ok();
-			goto drop;
-		}
+		pool.collect(stored);
+		on_stored(stored);
+	}
 
-		if (req.verb.match("put") || req.verb.match("delete"))
-		{
-			handle_api_request(req);
-			goto drop;
-		}
+	// let the pending writes complete and reply to them
 
-		sk_send(conn, "HTTP/1.1 405 Unsupported Method\r\n");
+	pool.stop();
+	pool.collect(stored);
+	on_stored(stored);
 
-drop:
+	for (auto & conn : conns)
+	{
+		ev_put(ev_conn_close, conn.serial, conn.requests);
+		cap_close_conn(conn.serial);
+		drop_temp(conn);
 		conn.clear();
-		trace_i("Connection closed\n\n");
-
-		on_engine_activity();
 	}
 
+	conns.clear();
+
+	close_capture();
+
 	closesocket(srv);
 	srv = -1;
 
+	//
+	buf_pool_stats bs;
+
+	sk_bufs.get_stats(bs);
+	sk_bufs.trim();
+
+	trace_i("Buffers: %llu handed out, %.1f%% from the pool, %llu released, peak %zu KB\n",
+		bs.gets, bs.gets ? 100. * bs.hits / bs.gets : 0., bs.released, bs.peak / 1024);
+
 	trace_i("Server shut down\n");
 }
 
@@ -223,406 +559,931 @@ void the_engine::stop()
 		return;
 
 	enough = true;
-	closesocket(srv);
 	WaitForSingleObject(self, -1);
 }
 
 /*
  *	private
  */
-bool the_engine::recv_payload(size_t bytes)
+bool the_engine::accept_conns()
 {
-	while (conn.fill < conn.pos + bytes)
+	while (conns.size() < max_conns)
 	{
-		conn.replenish_buf();
+		sockaddr_in peer = { AF_INET };
+		int alen = sizeof(peer);
+		SOCKET sk;
 
-		int rc = sk_recv(conn);
-		if (rc <= 0)
-			return false;
-	}
+		sk = accept(srv, (sockaddr*)&peer, &alen);
+		if (sk == -1)
+		{
+			if (sk_errno() == WSAEWOULDBLOCK)
+				break; // no more pending connections
+
+			wsa_error("accept");
+
+			if (sk_accept_fatal())
+				return false;
+
+			continue;
+		}
 
-	trace_v("Payload:\n-------\n%.*s\n-------\n", conn.fill-conn.pos, conn.buf.data()+conn.pos);
+		trace_i("Connection accepted from %s\n", sa_to_str(peer).c_str());
+
+		conns.emplace_back();
+
+		auto & conn = conns.back();
+
+		conn.sk = sk;
+		conn.serial = ++serials;
+		conn.peer = peer;
+		conn.last = GetTickCount();
+		conn.t_start = get_usec();
+		conn.c_start = sp_clock();
+
+		mx_accepted();
+
+		ev_put(ev_conn_open, conn.serial, ntohl(peer.sin_addr.s_addr), ntohs(peer.sin_port));
+		cap_open_conn(conn.serial);
+
+		if (! sk_unblock(conn.sk))
+		{
+			conn.clear();
+			conns.pop_back();
+			continue;
+		}
+
+		conn.alloc_buf();
+	}
 
 	return true;
 }
 
-bool the_engine::send_cors_ok()
+/*
+ *	returns false if the connection is to be closed
+ */
+bool the_engine::on_readable(en_conn & conn)
 {
-	const char * open_bar =
-		"HTTP/1.1 204 No Content\r\n"
-		"Allow: OPTIONS, GET, PUT, DELETE\r\n"
-		"Access-Control-Allow-Origin: *\r\n"
-		"Access-Control-Allow-Headers: *\r\n"
-		"Access-Control-Allow-Methods: OPTIONS, GET, PUT, DELETE\r\n"
-		"Cache-Control: no-cache\r\n";
+	int rc;
+
+	conn.replenish_buf(conf.conn_buf);
+
+	{
+		sp_scope sp("sk_recv", conn.serial, conn.route_tag());
+		rc = sk_recv(conn);
+	}
+	if (rc == -2)
+		return true; // spurious wake-up
+
+	if (rc <= 0)
+		return false;
 
-	return sk_send(conn, (char*)open_bar) > 0;
+	mx_bytes_in(rc);
+	conn.last = GetTickCount();
+
+	return advance(conn);
 }
 
-bool the_engine::send_ok()
+bool the_engine::on_writable(en_conn & conn)
 {
-	const char * ok =
-		"HTTP/1.1 204 OK\r\n"
-		"Access-Control-Allow-Origin: *\r\n"
-		"Cache-Control: no-cache\r\n";
+	conn.last = GetTickCount();
+
+	if (! send_more(conn))
+		return false;
+
+	if (conn.state == en_conn::st_sending)
+		return true; // not yet
 
-	return sk_send(conn, (char*)ok) > 0;
+	if (! conn.keep_alive || enough)
+		return false;
+
+	conn.next();
+	return advance(conn);
 }
 
 /*
- *	put     /test
- *	put     /config
- *	put     /board/<board-id>
- *	delete  /board/<board-id>
+ *	Runs through as many of the buffered requests as possible.
+ *	Returns false if the connection is to be closed.
  */
-bool the_engine::handle_api_request(http_req & req)
+bool the_engine::advance(en_conn & conn)
 {
-	ch_range_vec parts;
+	int rc;
 
-	if (! req.path.starts_with("/"))
+	for (;;)
 	{
-		trace_e("Invalid path 1\n");
-		sk_send(conn, nope_400("Invalid path, 1"));
-		return false;
-	}
+		if (conn.state == en_conn::st_headers)
+		{
+			if (! conn.fill)
+				return true; // idle
 
-	req.path.tokenize("/", parts, true);
+			if (! conn.t_start)
+			{
+				conn.t_start = get_usec();
+				conn.c_start = sp_clock();
+			}
 
-	if (parts.size() < 1)
-	{
-		trace_e("Invalid path 2\n");
-		sk_send(conn, nope_400("Invalid path, 2"));
-		return false;
-	}
+			// read HTTP request headers - ie just read up to \r\n\r\n
 
-	//
-	ch_range  * clen = NULL;
-	ch_range  * auth = NULL;
-	area_info * area = NULL;
-	size_t bytes;
-	int n;
-
-	for (auto & h : req.headers)
-		if (h.name.match("content-length"))
-			clen = &h.value;
-		else
-		if (h.name.match("x-access-token"))
-			auth = &h.value;
+			{
+				sp_scope sp("parse_http_request", conn.serial, conn.route_tag());
+				rc = parse_http_request(conn, conn.req);
+			}
+			if (rc < 0)
+				return false; // something's malformed
 
-	if (! auth)
-	{
-		trace_i("No X-Access-Token header\n");
-		sk_send(conn, nope_400("No Access-Token header"));
-		return false;
+			if (rc == 0)
+			{
+				if (conn.fill < max_head_size)
+					return true;
+
+				trace_e("Request headers are too large\n");
+				return false;
+			}
+
+			conn.t_head = get_usec();
+			mx_time(mx_headers, conn.t_head - conn.t_start);
+
+			cap_request(conn.serial, conn.req, &conn.buf[0], conn.pos);
+
+			if (! on_headers(conn))
+				return conn.state == en_conn::st_sending; // closed once the reply is out
+
+			if (conn.state == en_conn::st_payload)
+			{
+				// conn.req is not to be used past this point as it references
+				// conn.buf and the latter gets shifted around by the payload
+
+				conn.req.reset();
+			}
+		}
+
+		if (conn.state == en_conn::st_payload)
+		{
+			if (! on_payload(conn))
+				return conn.state == en_conn::st_sending; // ditto
+
+			if (conn.state == en_conn::st_payload)
+				return true; // not yet
+		}
+
+		if (conn.state == en_conn::st_storing || conn.state == en_conn::st_sending)
+			return true;
+
+		// still at st_headers means that the request has been replied to
+
+		__enforce(conn.state == en_conn::st_headers);
+
+		if (! conn.keep_alive)
+			return false;
+
+		conn.next();
 	}
+}
+
+/*
+ *	Returns false if the connection is to be closed, otherwise
+ *	either replies in full or moves the connection to st_payload.
+ */
+bool the_engine::on_headers(en_conn & conn)
+{
+	http_req & req = conn.req;
+	ch_range   * keep = req.header(hh_connection);
+	ch_range   * clen = req.header(hh_content_length);
+	bool         body;
+
+	body = (clen && ! clen->match("0")) || req.header(hh_transfer_encoding);
 
-	for (auto & a : conf.areas)
+	// HTTP/1.1 defaults to keep-alive, 1.0 - to close
+
+	conn.keep_alive = req.proto.match("HTTP/1.1");
+
+	if (keep)
 	{
-		if (auth->match( (string&)a.first ))
+		for (auto & opt : keep->tokens(",", true))
 		{
-			area = &a.second;
-			break;
+			opt.trim();
+
+			if (opt.match("close"))      conn.keep_alive = false; else
+			if (opt.match("keep-alive")) conn.keep_alive = true;
 		}
 	}
 
-	if (! area)
+	if (++conn.requests >= max_requests)
+		conn.keep_alive = false;
+
+	//
+	if (req.verb.match("put"))     conn.verb = vb_put;     else
+	if (req.verb.match("options")) conn.verb = vb_options; else
+	if (req.verb.match("delete"))  conn.verb = vb_delete;  else
+	if (req.verb.match("get"))     conn.verb = vb_get;
+
+	if (conn.verb == vb_put)
+		return handle_api_request(conn);
+
+	// there's no reading past the body we don't expect
+
+	if (body)
+		conn.keep_alive = false;
+
+	if (conn.verb == vb_options)
+		return send_cors_ok(conn);
+
+	if (conn.verb == vb_delete || conn.verb == vb_get)
+		return handle_api_request(conn);
+
+	nope(conn, "Unsupported method", 405, "Unsupported Method");
+	return false;
+}
+
+/*
+ *	Runs the payload through the form reader as it comes in. The
+ *	fields are decoded in place, in conn.buf, and if the board
+ *	data doesn't fit into conn.buf in full, it is sent out to a
+ *	temp file in pieces. Returns false if the connection is to
+ *	be closed.
+ */
+bool the_engine::on_payload(en_conn & conn)
+{
+	ch_range  in, piece, data;
+	size_t    avail;
+	bool      last;
+	uint64_t  t0, c0;
+
+	/*
+		Content-Type: application/x-www-form-urlencoded; charset=UTF-8
+		data=%7B%22format%22%3...&meta=%7B%22...
+	*/
+
+	avail = conn.fill - conn.pos;
+	if (avail > conn.left)
+		avail = conn.left;
+
+	last = (avail == conn.left);
+
+	// wait for either the whole payload or a full buffer
+
+	if (! last && conn.fill < conf.conn_buf)
+		return true;
+
+	in = ch_range( &conn.buf[conn.pos], avail );
+
+	trace_v("Payload:\n-------\n%.*s\n-------\n", __str(in));
+
+	// what the form reader left unconsumed last time is captured already
+
+	if (conn.cap_left > conn.left - avail)
 	{
-		trace_i("X-Access-Token mismatch\n");
-		sk_send(conn, nope("Invalid access token", 403, "Access denied"));
-		return false;
+		size_t seen = conn.left - conn.cap_left;
+
+		cap_payload(conn.serial, in.data + seen, avail - seen);
+		conn.cap_left = conn.left - avail;
 	}
 
-	if (req.verb.match("put"))
+	t0 = get_usec();
+	c0 = sp_clock();
+
+	while (conn.form.next(in, last, piece))
 	{
-		ch_range      bulk;
-		ch_range_vec  args;
+		ch_range  key(conn.form.key);
+		string  * dst;
 
-		if (! clen)
+		if (conn.route == rt_put_config ? key.match("conf") :
+		    conn.route == rt_put_board  ? key.match("data") : false)
 		{
-			trace_e("No Content-Length header\n");
-			sk_send(conn, nope_400("No Content-Length header"));
-			return false;
+			if (conn.data_done)
+				continue; // use the first one
+
+			data = piece;
+			conn.data_size += piece.size;
+			conn.data_done = conn.form.ended;
+
+			if (conn.route == rt_put_board && ! conn.scan.feed(piece))
+			{
+				trace_e("Malformed board data - %s\n", conn.scan.error);
+				nope_400(conn, "Malformed board data");
+				return false;
+			}
+
+			continue;
 		}
 
-		if (clen->scanf("%zu%n", &bytes, &n) != 1 || n != clen->size)
+		if (key.match("meta")) dst = &conn.meta; else
+		if (key.match("self")) dst = &conn.self; else
+			continue;
+
+		if (dst->size() + piece.size > conf.conn_buf)
 		{
-			trace_e("Invalid Content-Length header\n");
-			sk_send(conn, nope_400("Invalid Content-Length header"));
+			trace_e("The \"%.*s\" field is too large\n", __str(key));
+			nope(conn, "Form field is too large", 413, "Payload Too Large");
 			return false;
 		}
 
-		if (! recv_payload(bytes))
-			return false;
+		dst->append(piece.data, piece.size);
+	}
 
-		/*
-			Content-Type: application/x-www-form-urlencoded; charset=UTF-8
-			data=%7B%22format%22%3...&meta=%7B%22...
-		*/
+	conn.t_decode += get_usec() - t0;
+	sp_put("percent_decode", conn.serial, conn.route_tag(), c0, sp_clock());
 
-		bulk = ch_range( (char*)conn.buf.data() + conn.pos, conn.fill - conn.pos );
-		bulk.tokenize("&", args, false);
+	// 'in' is now at the first byte not consumed
 
-		if (parts.size() == 1 && parts[0].match("config"))
-			return handle_put_config(*area, args);
+	conn.left -= in.data - &conn.buf[conn.pos];
+	conn.pos   = in.data - &conn.buf[0];
 
-		if (parts.size() == 2 && parts[0].match("board"))
-			return handle_put_board(*area, args, parts[1].to_str());
+	if (last)
+	{
+		mx_time(mx_body, get_usec() - conn.t_head);
+		mx_time(mx_decode, conn.t_decode);
+		return on_request(conn, data);
+	}
 
-		trace_e("Invalid PUT request\n");
+	if (! data.size)
+	{
+		conn.discard(conn.pos);
+		return true;
 	}
-	else
-	if (req.verb.match("delete"))
+
+	// on_stored() discards the piece and resumes reading
+
+	store_job & job = conn.job;
+
+	job = store_job();
+
+	if (conn.temp.empty())
 	{
-		if (parts.size() == 2 && parts[0].match("board"))
-			return handle_del_board(*area, parts[1]);
+		wchar_t name[64] = { 0 };
 
-		trace_e("Invalid DELETE request\n");
+		wsprintf(name, L".upload-%lu-%u.tmp", GetCurrentProcessId(), ++uploads);
+		conn.temp = name;
+		job.fresh = true;
 	}
 
-	sk_send(conn, nope_400("Invalid request"));
+	trace_v("Appending %zu bytes to [%S]\n", data.size, conn.temp.c_str());
+
+	job.type  = store_job::append;
+	job.area  = conn.area->folder;
+	job.temp  = conn.temp;
+	job.data  = data;
+	job.owner = &conn;
+	job.conn  = conn.serial;
+	job.route = conn.route_tag();
+
+	conn.set_state(en_conn::st_storing);
+	pool.submit(&job);
+	return true;
+}
+
+bool the_engine::on_request(en_conn & conn, const ch_range & data)
+{
+	if (conn.route == rt_put_test)
+		return handle_put_test(conn, *conn.area);
+
+	if (conn.route == rt_put_config)
+		return handle_put_config(conn, *conn.area, data);
+
+	if (conn.route == rt_put_board)
+		return handle_put_board(conn, *conn.area, data, conn.id);
+
+	__enforce(false);
 	return false;
 }
 
-//
-bool the_engine::handle_put_test(area_info & area, ch_range_vec & args)
+void the_engine::on_stored(store_job_vec & stored)
+{
+	for (auto job : stored)
+	{
+		if (job->owner == &saves)
+			saves.on_stored(*job);
+		else
+		if (job == &ini_job)
+		{
+			if (! job->ok)
+				trace_e("Failed to save the ini - %s\n", job->error);
+
+			ini_queued = false;
+		}
+		else
+			on_stored( *(en_conn*)job->owner );
+	}
+}
+
+void the_engine::on_stored(en_conn & conn)
 {
-	string self;
+	__enforce(conn.state == en_conn::st_storing);
 
-	for (auto & arg : args)
+	ev_put(ev_stored, conn.serial, conn.job.ok, conn.job.data.size);
+
+	if (! conn.job.ok)
 	{
-		ch_range k, v;
+		if (conn.job.missing)
+			nope_400(conn, conn.job.error);
+		else
+			nope_500(conn, conn.job.error);
 
-		if (! arg.split("=", k, v))
-			continue;
+		if (conn.state != en_conn::st_sending)
+			conn.set_state(en_conn::st_done);
+		return;
+	}
+
+	if (conn.job.type == store_job::append)
+	{
+		if (enough)
+		{
+			conn.set_state(en_conn::st_done); // the pool is stopped
+			return;
+		}
+
+		conn.job = store_job();
+		conn.discard(conn.pos);
+		conn.last = GetTickCount();
+		conn.set_state(en_conn::st_payload);
 
-		if (k.match("self")) self = v.to_str();
+		if (! advance(conn))
+			conn.set_state(en_conn::st_done);
+		return;
 	}
 
-	percent_decode(self);
+	conn.job = store_job(); // drop the views into conn.buf
+	conn.temp.clear();      // moved in place
+	conn.set_state(en_conn::st_headers);
 
-	//
-	if (self.size())
+	// no more requests once shutting down, the pool is stopped
+
+	if (! send_ok(conn))
+	{
+		conn.set_state(en_conn::st_done);
+		return;
+	}
+
+	if (conn.state == en_conn::st_sending)
+		return; // on_writable() carries on
+
+	if (! conn.keep_alive || enough)
 	{
-		area.url = to_wstr(self);
-		save_ini();
+		conn.set_state(en_conn::st_done);
+		return;
 	}
 
-	return send_ok();
+	conn.next();
+
+	if (! advance(conn))
+		conn.set_state(en_conn::st_done);
+}
+
+bool the_engine::send_cors_ok(en_conn & conn)
+{
+	string open_bar =
+		"HTTP/1.1 204 No Content\r\n"
+		"Allow: OPTIONS, GET, PUT, DELETE\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Access-Control-Allow-Headers: *\r\n"
+		"Access-Control-Allow-Methods: OPTIONS, GET, PUT, DELETE\r\n"
+		"Cache-Control: no-cache\r\n";
+
+	open_bar += conn_header(conn);
+	return queue_reply(conn, 204, open_bar);
 }
 
-bool the_engine::handle_put_config(area_info & area, ch_range_vec & args)
+bool the_engine::send_ok(en_conn & conn)
 {
-	wstring  path;
-	wstring  file;
-	string   self;
-	string   data;
+	string ok =
+		"HTTP/1.1 204 OK\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Cache-Control: no-cache\r\n";
 
-	trace_i("put /config\n");
+	ok += conn_header(conn);
+	return queue_reply(conn, 204, ok);
+}
+
+/*
+ *	The area's url is changed right away and the ini is saved by
+ *	the pool, with the changes that come in meanwhile folded into
+ *	the save that follows.
+ */
+void the_engine::update_url(en_conn & conn)
+{
+	if (conn.self.size() && set_area_url(conn.area, to_wstr(conn.self)))
+	{
+		ini_dirty = true;
+		flush_ini();
+	}
+}
 
-	for (auto & arg : args)
+bool the_engine::flush_ini() // true while a save is queued
+{
+	if (ini_dirty && ! ini_queued)
 	{
-		ch_range k, v;
+		ini_job = store_job();
 
-		if (! arg.split("=", k, v))
-			continue;
+		ini_job.type  = store_job::put_ini;
+		ini_job.owner = this;
+		ini_job.route = "settings.ini";
 
-		if (k.match("self")) self = v.to_str(); else;
-		if (k.match("conf")) data = v.to_str();
+		ini_dirty  = false;
+		ini_queued = true;
+		pool.submit(&ini_job);
 	}
 
-	percent_decode(self);
-	percent_decode(data);
+	return ini_queued;
+}
 
-	//
-	path = conf.path + L"\\" + area.folder;
+/*
+ *	For PUTs this only validates the request and resolves its
+ *	route, the rest is done by on_payload() and on_request() as
+ *	the payload comes in.
+ */
+bool the_engine::handle_api_request(en_conn & conn)
+{
+	http_req  & req = conn.req;
+	ch_range  * clen = req.header(hh_content_length);
+	ch_range  * auth = req.header(hh_x_access_token);
+	area_ref    area;
+	ch_range    id;
+	int         route = find_route(conn.verb, req.path, id);
+	uint64_t    bytes;
+
+	if (route == rt_none)
+	{
+		trace_e("Invalid request - %.*s %.*s\n", __str(req.verb), __str(req.path));
+		nope_400(conn, "Invalid request");
+		return false;
+	}
 
-	if (! make_path(path))
+	conn.route = route;
+
+	// counters only, so no access token for the scrapers
+
+	if (route == rt_get_metrics)
+		return handle_get_metrics(conn);
+
+	if (! auth)
 	{
-		trace_e("Failed to create [%S] folder\n", path.c_str());
-		sk_send(conn, nope_500("make_path() failed"));
+		trace_i("No X-Access-Token header\n");
+		nope_400(conn, "No Access-Token header");
 		return false;
 	}
 
-	if (data.size())
+	area = find_area(*auth);
+
+	if (! area)
 	{
-		file = path + L"\\app-config.json";
-		if (! save_file(file, data))
-		{
-			trace_e("Failed to save [%S]\n", file.c_str());
-			sk_send(conn, nope_500("save_file() failed"));
-			return false;
-		}
+		trace_i("X-Access-Token mismatch\n");
+		nope(conn, "Invalid access token", 403, "Access denied");
+		return false;
+	}
+
+	// the spans tell what was done when, so any of the tokens will do
+
+	if (route == rt_get_spans)
+		return handle_get_spans(conn);
+
+	if (route == rt_del_board)
+	{
+		ev_put(ev_request, conn.serial, route, 0, req.path.data, req.path.size);
+		return handle_del_board(conn, *area, id);
+	}
+
+	//
+	if (! clen)
+	{
+		trace_e("No Content-Length header\n");
+		nope_400(conn, "No Content-Length header");
+		return false;
 	}
 
-	if (self.size())
+	if (! clen->to_u64(bytes) || bytes > (size_t)-1)
 	{
-		area.url = to_wstr(self);
-		save_ini();
+		trace_e("Invalid Content-Length header\n");
+		nope_400(conn, "Invalid Content-Length header");
+		return false;
 	}
 
-	return send_ok();
+	ev_put(ev_request, conn.serial, route, bytes, req.path.data, req.path.size);
+
+	conn.set_state(en_conn::st_payload);
+	conn.left  = (size_t)bytes;
+	conn.area  = area;
+	conn.id    = id.to_str();
+
+	conn.cap_left = conn.left;
+	return true;
+}
+
+//
+bool the_engine::handle_put_test(en_conn & conn, area_info & area)
+{
+	trace_i("put /test\n");
+
+	update_url(conn);
+
+	conn.set_state(en_conn::st_headers);
+	return send_ok(conn);
+}
+
+bool the_engine::handle_put_config(en_conn & conn, area_info & area, const ch_range & data)
+{
+	store_job & job = conn.job;
+
+	trace_i("put /config\n");
+
+	update_url(conn);
+
+	// the reply is sent by on_stored()
+
+	job = store_job();
+
+	job.type  = store_job::put_config;
+	job.area  = area.folder;
+	job.data  = data;
+	job.temp  = conn.temp;
+	job.owner = &conn;
+	job.conn  = conn.serial;
+	job.route = conn.route_tag();
+
+	conn.set_state(en_conn::st_storing);
+	pool.submit(&job);
+	return true;
 }
 
-bool the_engine::handle_put_board(area_info & area, ch_range_vec & args, const string & _id)
+bool the_engine::handle_put_board(en_conn & conn, area_info & area, const ch_range & data, const string & _id)
 {
+	store_job & job = conn.job;
 	ch_range  id_str( (string&)_id );
 	uint64_t  id_u64;
-	wstring   path;
-	wstring   file;
-	string    self;
-	string    data;
-	string    meta;
 
 	trace_i("put /board/%.*s\n", __str(id_str));
 
 	//
-	if (! id_str.is_decimal() || ! id_str.scanf("%I64u", &id_u64))
+	if (! id_str.to_u64(id_u64))
 	{
 		trace_e("Invalid board id\n");
-		sk_send(conn, nope_400("Invalid board ID"));
+		nope_400(conn, "Invalid board ID");
 		return false;
 	}
 
-	path = conf.path + L"\\" + area.folder + L"\\" + id_str.to_wstr();
-
-	//
-	for (auto & arg : args)
-	{
-		ch_range k, v;
-
-		if (! arg.split("=", k, v))
-			continue;
-
-		if (k.match("self")) self = v.to_str(); else;
-		if (k.match("data")) data = v.to_str(); else
-		if (k.match("meta")) meta = v.to_str();
-	}
-
-	percent_decode(self);
-	percent_decode(data);
-	percent_decode(meta);
-
 /*
 	self: { }
 	meta: {"title":"1232","current":3,"ui_spot":0,"history":[3,2,1],"backups":[]}
 	data: {"format":20190412,"id":1618261845169,"revision":3,"title":"1232","lists":[{"title":"List","notes":[{"text":"123","raw":false,"min":false}]}]}
  */
 
-	if (! make_path(path))
-	{
-		trace_e("Failed to create [%S] folder\n", path.c_str());
-		sk_send(conn, nope_500("make_path() failed"));
-		return false;
-	}
+	if (conn.meta.size())
+		trace_v("Meta:\n-------\n%s\n-------\n", conn.meta.c_str());
 
-	if (meta.size())
+	if (conn.data_size)
 	{
-		trace_v("Meta:\n-------\n%s\n-------\n", meta.data());
+		trace_v("Data: %I64u bytes\n", conn.data_size);
 
-		file = path + L"\\meta.json";
-		if (! save_file(file, meta))
+		if (! conn.scan.finish())
 		{
-			trace_e("Failed to save [%S]\n", file.c_str());
-			sk_send(conn, nope_500("save_file() failed"));
+			trace_e("Malformed board data - %s\n", conn.scan.error);
+			nope_400(conn, "Malformed board data");
 			return false;
 		}
 
-		trace_i("meta saved in [%S]\n", file.c_str());
-	}
-
-	if (data.size())
-	{
-		ch_range foo(data);
-		char   * ptr;
-		uint_t   rev = 0;
-		wchar_t  name[64] = { 0 };
-
-		trace_v("Data:\n-------\n%s\n-------\n", data.data());
-
-		ptr = foo.find("\"revision\":");
-		if (! ptr)
+		if (! conn.scan.revision.seen)
 		{
 			trace_e("Failed to find board revision\n");
-			sk_send(conn, nope_400("No revision in board data"));
+			nope_400(conn, "No revision in board data");
 			return false;
 		}
 
-		foo.advance_to(ptr + 11);
-		if (! foo.scanf("%u", &rev))
+		if (! conn.scan.revision.ok || conn.scan.revision.val > 0xffffffff)
 		{
 			trace_e("Invalid board revision\n");
-			sk_send(conn, nope_400("Bad board revision"));
+			nope_400(conn, "Bad board revision");
 			return false;
 		}
 
-		wsprintf(name, L"rev-%08u.nbx", rev);
-		file = path + L"\\" + name;
-
-		if (! save_file(file, data))
+		if (conn.scan.id.seen && (! conn.scan.id.ok || conn.scan.id.val != id_u64))
 		{
-			trace_e("Failed to save [%S]\n", file.c_str());
-			sk_send(conn, nope_500("save_file() failed"));
+			trace_e("Board id in the data doesn't match the URL\n");
+			nope_400(conn, "Board ID mismatch");
 			return false;
 		}
 
-		trace_i("data saved in [%S]\n", file.c_str());
+		trace_i("Board [%s], revision %I64u, format %I64u\n",
+			conn.scan.title.c_str(), conn.scan.revision.val, conn.scan.format.val);
 	}
 
-	if (self.size())
+	update_url(conn);
+
+	// held in memory and replied to right away, the temp goes with it
+
+	if (area.coalesce && ! enough)
 	{
-		area.url = to_wstr(self);
-		save_ini();
+		saves.hold(area.folder, area.coalesce, _id, (uint_t)conn.scan.revision.val, conn.meta, data, conn.temp);
+
+		conn.temp.clear();
+		conn.set_state(en_conn::st_headers);
+		return send_ok(conn);
 	}
 
-	return send_ok();
+	// the reply is sent by on_stored()
+
+	job = store_job();
+
+	job.type  = store_job::put_board;
+	job.area  = area.folder;
+	job.board = _id;
+	job.rev   = (uint_t)conn.scan.revision.val;
+	job.meta  = conn.meta;
+	job.data  = data;
+	job.temp  = conn.temp;
+	job.owner = &conn;
+	job.conn  = conn.serial;
+	job.route = conn.route_tag();
+
+	conn.set_state(en_conn::st_storing);
+	pool.submit(&job);
+	return true;
 }
 
 //
-bool the_engine::handle_del_board(area_info & area, const ch_range & id)
+bool the_engine::handle_del_board(en_conn & conn, area_info & area, const ch_range & id)
 {
-	uint64_t  board_id;
-	wstring   path;
-	wstring   arch;
+	store_job & job = conn.job;
+	uint64_t    board_id;
 
 	// id references conn.buf (!)
 
 	trace_i("delete /board/%.*s\n", __str(id));
 
-	if (! id.is_decimal() || ! id.scanf("%I64u", &board_id))
+	if (! id.to_u64(board_id))
 	{
 		trace_e("Invalid board id\n");
-		sk_send(conn, nope_400("Invalid board ID"));
+		nope_400(conn, "Invalid board ID");
 		return false;
 	}
 
-	path = conf.path + L"\\" + area.folder + L"\\" + id.to_wstr();
-	arch = conf.path + L"\\" + area.folder + L"\\$DeletedBoards";
+	// done by the pool, after the writes to the board that are
+	// already queued, the reply is sent by on_stored()
 
-	if (! folder_exists(path))
-	{
-		trace_e("Non-existent board\n");
-		sk_send(conn, nope_400("Non-existent board"));
-		return false;
-	}
+	job = store_job();
 
-	if (! make_path(arch))
-	{
-		trace_e("Failed to create [%S] folder\n", arch.c_str());
-		sk_send(conn, nope_500("make_path() failed"));
-		return false;
-	}
+	job.held  = saves.drop(area.folder, id.to_str());
+	job.type  = store_job::del_board;
+	job.area  = area.folder;
+	job.board = id.to_str();
+	job.owner = &conn;
+	job.conn  = conn.serial;
+	job.route = conn.route_tag();
 
-	arch += L"\\" + id.to_wstr();
+	conn.set_state(en_conn::st_storing);
+	pool.submit(&job);
+	return true;
+}
 
-	if (! MoveFileEx(path.c_str(), arch.c_str(), 0))
-	{
-		trace_e("MoveFileEx() failed %lu\n", GetLastError());
-		trace_i("[%S] -> [%S]\n", path.c_str(), arch.c_str());
-		sk_send(conn, nope_500("move_file() failed"));
-		return false;
-	}
+/*
+ *	Prometheus text format. The counters are summed up across
+ *	the threads here, the gauges are read off the engine. There's
+ *	no CORS header, the scrapers don't need one and web pages are
+ *	not to read it.
+ */
+static const char * mx_verb_names[mx_verbs]   = { "other", "OPTIONS", "GET", "PUT", "DELETE" };
+static const char * mx_route_names[mx_routes] = { "other", "/test", "/config", "/board", "/board", "/metrics", "/spans" };
+static const char * mx_code_names[mx_codes]   = { "other", "200", "204", "400", "403", "405", "413", "500" };
+static const char * mx_stage_names[mx_stages] = { "headers", "body", "decode", "queue", "disk", "response" };
+
+bool the_engine::handle_get_metrics(en_conn & conn)
+{
+	mx_totals       mx;
+	store_stats     ss;
+	co_stats        cs;
+	buf_pool_stats  bs;
+	size_t          states[en_conn::st_sending + 1] = { 0 };
+	string          text;
+	string          head;
+
+	trace_i("get /metrics\n");
+
+	mx_collect(mx);
+	pool.get_stats(ss);
+	saves.get_stats(cs);
+	sk_bufs.get_stats(bs);
+
+	for (auto & c : conns)
+		states[c.state]++;
+
+	//
+	text += "# TYPE nbagent_requests_total counter\n";
+
+	for (size_t v=0; v<mx_verbs; v++)
+		for (size_t r=0; r<mx_routes; r++)
+			for (size_t c=0; c<mx_codes; c++)
+				if (mx.requests[v][r][c])
+					text += stringf("nbagent_requests_total{verb=\"%s\",route=\"%s\",code=\"%s\"} %llu\n",
+						mx_verb_names[v], mx_route_names[r], mx_code_names[c], mx.requests[v][r][c]);
+
+	text += "# TYPE nbagent_connections_accepted_total counter\n";
+	text += stringf("nbagent_connections_accepted_total %llu\n", mx.accepted);
+
+	text += "# TYPE nbagent_received_bytes_total counter\n";
+	text += stringf("nbagent_received_bytes_total %llu\n", mx.bytes_in);
+
+	text += "# TYPE nbagent_sent_bytes_total counter\n";
+	text += stringf("nbagent_sent_bytes_total %llu\n", mx.bytes_out);
+
+	text += "# TYPE nbagent_stage_seconds histogram\n";
+
+	for (size_t i=0; i<mx_stages; i++)
+		mx.stages[i].print(text, "nbagent_stage_seconds", stringf("stage=\"%s\"", mx_stage_names[i]));
+
+	// gauges
+
+	text += "# TYPE nbagent_connections gauge\n";
+	text += stringf("nbagent_connections{state=\"headers\"} %zu\n", states[en_conn::st_headers]);
+	text += stringf("nbagent_connections{state=\"payload\"} %zu\n", states[en_conn::st_payload]);
+	text += stringf("nbagent_connections{state=\"storing\"} %zu\n", states[en_conn::st_storing]);
+	text += stringf("nbagent_connections{state=\"sending\"} %zu\n", states[en_conn::st_sending]);
+	text += stringf("nbagent_connections{state=\"done\"} %zu\n",    states[en_conn::st_done]);
+
+	text += "# TYPE nbagent_store_queue_depth gauge\n";
+	text += stringf("nbagent_store_queue_depth %zu\n", ss.queued);
+
+	text += "# TYPE nbagent_store_queue_peak gauge\n";
+	text += stringf("nbagent_store_queue_peak %zu\n", ss.queued_max);
+
+	text += "# TYPE nbagent_store_workers gauge\n";
+	text += stringf("nbagent_store_workers %zu\n", ss.workers);
+
+	text += "# TYPE nbagent_store_jobs_total counter\n";
+	text += stringf("nbagent_store_jobs_total %llu\n", ss.jobs);
+
+	text += "# TYPE nbagent_store_failed_total counter\n";
+	text += stringf("nbagent_store_failed_total %llu\n", ss.failed);
+
+	// utilisation = work / (workers * uptime), latency = (wait + work) / jobs
+
+	text += "# TYPE nbagent_store_wait_usec_total counter\n";
+	text += stringf("nbagent_store_wait_usec_total %llu\n", ss.wait_usec);
+
+	text += "# TYPE nbagent_store_work_usec_total counter\n";
+	text += stringf("nbagent_store_work_usec_total %llu\n", ss.work_usec);
+
+	text += "# TYPE nbagent_store_latency_max_usec gauge\n";
+	text += stringf("nbagent_store_latency_max_usec %llu\n", ss.latency_max);
+
+	text += "# TYPE nbagent_store_uptime_usec counter\n";
+	text += stringf("nbagent_store_uptime_usec %llu\n", ss.uptime_usec);
+
+	text += "# TYPE nbagent_held_boards gauge\n";
+	text += stringf("nbagent_held_boards %zu\n", cs.held);
+
+	text += "# TYPE nbagent_held_saves_total counter\n";
+	text += stringf("nbagent_held_saves_total %llu\n", cs.saves);
+
+	text += "# TYPE nbagent_held_superseded_total counter\n";
+	text += stringf("nbagent_held_superseded_total %llu\n", cs.superseded);
+
+	text += "# TYPE nbagent_held_writes_total counter\n";
+	text += stringf("nbagent_held_writes_total %llu\n", cs.writes);
+
+	text += "# TYPE nbagent_held_retries_total counter\n";
+	text += stringf("nbagent_held_retries_total %llu\n", cs.retried);
+
+	text += "# TYPE nbagent_held_failed_total counter\n";
+	text += stringf("nbagent_held_failed_total %llu\n", cs.failed);
+
+	text += "# TYPE nbagent_buffer_bytes gauge\n";
+	text += stringf("nbagent_buffer_bytes{kind=\"in_use\"} %zu\n", bs.in_use);
+	text += stringf("nbagent_buffer_bytes{kind=\"cached\"} %zu\n", bs.cached);
+
+	//
+	head = stringf(
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"Cache-Control: no-cache\r\n", text.size());
+
+	head += conn_header(conn);
+	head += text;
+
+	return queue_reply(conn, 200, head);
+}
+
+/*
+ *	Chrome trace-event JSON, for chrome://tracing or Perfetto. It
+ *	needs an access token and it's not for web pages, so there's
+ *	no CORS header.
+ */
+bool the_engine::handle_get_spans(en_conn & conn)
+{
+	string json;
+	string head;
+
+	trace_i("get /spans\n");
+
+	sp_export(json);
+
+	head = stringf(
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: application/json\r\n"
+		"Content-Length: %zu\r\n"
+		"Cache-Control: no-cache\r\n", json.size());
+
+	head += conn_header(conn);
+	head += json;
 
-	return send_ok();
+	return queue_reply(conn, 200, head);
 }
 
 //
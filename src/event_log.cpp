@@ -0,0 +1,337 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "event_log.h"
+#include "config.h"
+#include "utils.h"
+#include "trace.h"
+#include "routes.h"
+
+#include <algorithm>
+
+//
+static const char     ev_magic[8] = { 'n', 'b', '-', 'e', 'v', 'l', 'o', 'g' };
+static const uint32_t ev_version  = 1;
+
+static_assert(sizeof(ev_record) == 64, "ev_record is not 64 bytes");
+static_assert(sizeof(ev_header) == 64, "ev_header is not 64 bytes");
+
+struct ev_view
+{
+	HANDLE       file;
+	HANDLE       map;
+	ev_header  * head;
+	ev_record  * ring;
+	uint64_t     size;   // records in the ring
+
+	ev_view() { file = INVALID_HANDLE_VALUE; map = NULL; head = NULL; ring = NULL; size = 0; }
+
+	bool open(const wstring & name, bool writable);
+	void close();
+};
+
+static ev_view                   ev_log;
+static std::atomic<ev_record*>   ev_ring(NULL);  // ev_log's, NULL if not logging
+static uint64_t                  ev_size = 0;
+
+static std::atomic<uint64_t>  ev_next(1);
+
+/*
+ *	Slot reuse is ordered by 'seq' - it's zeroed before the record
+ *	is filled in and it's set once it's done. A record that is torn
+ *	by a crash is then seen as empty.
+ */
+void ev_put(uint16_t id, uint32_t conn, uint64_t a, uint64_t b, const char * text, size_t len)
+{
+	ev_record * ring = ev_ring.load(std::memory_order_acquire);
+	LARGE_INTEGER now;
+	ev_record * r;
+	uint64_t seq;
+
+	if (! ring)
+		return;
+
+	seq = ev_next.fetch_add(1, std::memory_order_relaxed);
+	r = ring + (seq % ev_size);
+
+	QueryPerformanceCounter(&now);
+
+	r->seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (len > sizeof r->text)
+		len = sizeof r->text;
+
+	r->time = now.QuadPart;
+	r->id   = id;
+	r->len  = (uint16_t)len;
+	r->conn = conn;
+	r->a    = a;
+	r->b    = b;
+
+	memcpy(r->text, text, len);
+
+	r->seq.store(seq, std::memory_order_release);
+}
+
+/*
+ *
+ */
+bool ev_view::open(const wstring & name, bool writable)
+{
+	LARGE_INTEGER bytes;
+
+	file = CreateFile(name.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+	                  FILE_SHARE_READ, NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return api_error("CreateFile", "%s", to_utf8(name).c_str());
+
+	if (writable)
+	{
+		bytes.QuadPart = sizeof(ev_header) + conf.event_log / sizeof(ev_record) * sizeof(ev_record);
+	}
+	else
+	{
+		if (! GetFileSizeEx(file, &bytes))
+			return api_error("GetFileSizeEx", "%s", to_utf8(name).c_str());
+
+		if (bytes.QuadPart < (LONGLONG)sizeof(ev_header))
+		{
+			trace_e("%s is too short to be an event log\n", to_utf8(name).c_str());
+			return false;
+		}
+	}
+
+	// extends the file if needed
+	map = CreateFileMapping(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, bytes.HighPart, bytes.LowPart, NULL);
+	if (! map)
+		return api_error("CreateFileMapping", "%s", to_utf8(name).c_str());
+
+	head = (ev_header*)MapViewOfFile(map, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)bytes.QuadPart);
+	if (! head)
+		return api_error("MapViewOfFile", "%s", to_utf8(name).c_str());
+
+	ring = (ev_record*)(head + 1);
+	size = (bytes.QuadPart - sizeof(ev_header)) / sizeof(ev_record);
+	return true;
+}
+
+void ev_view::close()
+{
+	if (head) UnmapViewOfFile(head);
+	if (map)  CloseHandle(map);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+
+	*this = ev_view();
+}
+
+bool open_event_log()
+{
+	wstring       file = conf.path + L"\\events.bin";
+	LARGE_INTEGER freq;
+	FILETIME      ft;
+	LARGE_INTEGER now;
+	uint64_t      last = 0;
+
+	__enforce(! ev_ring);
+
+	if (! conf.event_log)
+		return true; // off
+
+	if (! ev_log.open(file, true))
+	{
+		ev_log.close();
+		return false;
+	}
+
+	ev_header * head = ev_log.head;
+	ev_record * ring = ev_log.ring;
+	uint64_t    size = ev_log.size;
+
+	QueryPerformanceFrequency(&freq);
+
+	// carry on from the last record of the previous run, if it's of the same size
+
+	if (memcmp(head->magic, ev_magic, sizeof ev_magic) ||
+	    head->version != ev_version ||
+	    head->rec_size != sizeof(ev_record) ||
+	    head->records != size)
+	{
+		memset(head, 0, sizeof(ev_header) + size * sizeof(ev_record));
+
+		memcpy(head->magic, ev_magic, sizeof ev_magic);
+		head->version = ev_version;
+		head->rec_size = sizeof(ev_record);
+		head->records = size;
+	}
+	else
+	{
+		for (uint64_t i=0; i<size; i++)
+			if (last < ring[i].seq)
+				last = ring[i].seq;
+	}
+
+	head->freq = freq.QuadPart;
+	ev_next = last + 1;
+
+	ev_size = size;
+	ev_ring = ring;
+
+	trace_v("Event log: %s, %I64u records, last one %I64u\n", to_utf8(file).c_str(), size, last);
+
+	GetSystemTimeAsFileTime(&ft);
+	QueryPerformanceCounter(&now);
+
+	ev_put(ev_start, 0, ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime, now.QuadPart);
+	return true;
+}
+
+void close_event_log()
+{
+	if (! ev_ring)
+		return;
+
+	ev_put(ev_stop, 0);
+
+	// the ev_put()s that are already past the check may still
+	// write to it, so it's left mapped till the exit
+
+	ev_ring = NULL;
+
+	FlushViewOfFile(ev_log.head, 0);
+}
+
+/*
+ *	dump
+ */
+static const char * ev_names[ev_count] =
+{
+	"-",
+	"start",
+	"stop",
+	"trace",
+	"conn-open",
+	"conn-state",
+	"conn-close",
+	"request",
+	"stored",
+};
+
+// en_conn::st_xxx
+static const char * conn_states[] = { "headers", "payload", "storing", "done", "sending" };
+
+template <size_t N>
+static const char * name_of(const char * (& names)[N], uint64_t i)
+{
+	return (i < N) ? names[i] : "?";
+}
+
+static const char * route_of(uint64_t i) // rt_xxx
+{
+	return (i == rt_none) ? "none" : (i < rt_count) ? route_name((int)i) : "?";
+}
+
+static string time_str(uint64_t ft)
+{
+	FILETIME   utc, loc;
+	SYSTEMTIME st;
+
+	utc.dwLowDateTime  = (DWORD)ft;
+	utc.dwHighDateTime = (DWORD)(ft >> 32);
+
+	if (! FileTimeToLocalFileTime(&utc, &loc) || ! FileTimeToSystemTime(&loc, &st))
+		return "?";
+
+	return stringf("%04u-%02u-%02u %02u:%02u:%02u.%06u",
+		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond,
+		(uint_t)(ft % 10000000 / 10));
+}
+
+static string args_str(const ev_record & r)
+{
+	const char * ls = "ewivd";
+
+	switch (r.id)
+	{
+	case ev_start:      return "";
+	case ev_stop:       return "";
+	case ev_trace:      return stringf("%c %.*s:%I64u", r.a < 5 ? ls[r.a] : '?', r.len, r.text, r.b);
+	case ev_conn_open:  return sa_to_str((uint32_t)r.a, (uint16_t)r.b);
+	case ev_conn_state: return stringf("%s -> %s", name_of(conn_states, r.b), name_of(conn_states, r.a));
+	case ev_conn_close: return stringf("after %I64u request(s)", r.a);
+	case ev_request:    return stringf("%s - %.*s, %I64u bytes", route_of(r.a), r.len, r.text, r.b);
+	case ev_stored:     return stringf("%s, %I64u bytes", r.a ? "ok" : "failed", r.b);
+	}
+
+	return stringf("%I64u %I64u [%.*s]", r.a, r.b, r.len, r.text);
+}
+
+bool dump_event_log(const wstring & file)
+{
+	vector<ev_record*> recs;
+	ev_view  view;
+	uint64_t ft = 0, t0 = 0, freq;
+
+	if (! view.open(file, false))
+	{
+		view.close();
+		return false;
+	}
+
+	if (memcmp(view.head->magic, ev_magic, sizeof ev_magic) ||
+	    view.head->version != ev_version ||
+	    view.head->rec_size != sizeof(ev_record) ||
+	    view.head->records > view.size)
+	{
+		trace_e("%s is not an event log or it's of an unknown version\n", to_utf8(file).c_str());
+		view.close();
+		return false;
+	}
+
+	freq = view.head->freq ? view.head->freq : 1;
+
+	for (uint64_t i=0; i<view.head->records; i++)
+		if (view.ring[i].seq)
+			recs.push_back(view.ring + i);
+
+	std::sort(recs.begin(), recs.end(), [](ev_record * x, ev_record * y){ return x->seq < y->seq; });
+
+	// the time is relative to the last ev_start before it, if it's still there
+
+	for (auto r : recs)
+	{
+		string when;
+
+		if (r->id == ev_start)
+		{
+			ft = r->a;
+			t0 = r->b;
+		}
+
+		if (ft)
+		{
+			double dt = (double)(int64_t)(r->time - t0); // may be negative around the start
+			when = time_str(ft + (int64_t)(dt * 10000000 / freq));
+		}
+		else
+		{
+			when = stringf("%.6f", (double)r->time / freq);
+		}
+
+		printf("%s  %8I64u  %4u  %-10s  %s\n",
+			when.c_str(), r->seq.load(), r->conn,
+			(r->id < ev_count) ? ev_names[r->id] : "?",
+			args_str(*r).c_str());
+	}
+
+	printf("%zu event(s)\n", recs.size());
+
+	view.close();
+	return true;
+}
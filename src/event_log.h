@@ -0,0 +1,86 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include "types.h"
+
+#include <atomic>
+
+/*
+ *	An always-on binary log of what the agent does, kept in a
+ *	memory-mapped circular file, events.bin in conf.path. The
+ *	records are of fixed size, so logging an event is a counter
+ *	increment and a few stores, and the file survives a crash.
+ *
+ *	The file is read back with "-e <file>", see dump_event_log().
+ */
+enum
+{
+	ev_none,
+	ev_start,         // a: FILETIME, b: QueryPerformanceCounter() - the time base
+	ev_stop,
+	ev_trace,         // a: level, b: line, text: file
+	ev_conn_open,     // a: peer ip, b: peer port
+	ev_conn_state,    // a: new state, b: old state, see en_conn
+	ev_conn_close,    // a: requests served
+	ev_request,       // a: route, b: Content-Length, text: path
+	ev_stored,        // a: 1 if ok, b: bytes
+
+	ev_count
+};
+
+struct ev_record  // 64 bytes
+{
+	std::atomic<uint64_t>  seq;   // set last, 0 if it's being written
+	uint64_t               time;  // QueryPerformanceCounter() ticks
+	uint16_t               id;    // ev_xxx
+	uint16_t               len;   // of text
+	uint32_t               conn;  // 0 if not about a connection
+	uint64_t               a;
+	uint64_t               b;
+	char                   text[24]; // cut to fit
+};
+
+struct ev_header  // also 64 bytes
+{
+	char      magic[8];  // "nb-evlog"
+	uint32_t  version;
+	uint32_t  rec_size;
+	uint64_t  records;   // in the ring
+	uint64_t  freq;      // QueryPerformanceFrequency()
+	uint8_t   reserved[32];
+};
+
+//
+bool open_event_log();   // if conf.event_log is not 0
+void close_event_log();
+
+bool dump_event_log(const wstring & file); // prints it to stdout, oldest first
+
+void ev_put(uint16_t id, uint32_t conn, uint64_t a, uint64_t b, const char * text, size_t len);
+
+inline void ev_put(uint16_t id, uint32_t conn, uint64_t a = 0, uint64_t b = 0)
+{
+	ev_put(id, conn, a, b, NULL, 0);
+}
+
+/*
+ *	Trace call sites, see __trace(). Only errors, warnings and
+ *	info are logged, the rest are too chatty to keep.
+ */
+#define EV_TRACE_MAX  2
+
+#define __ev_file_tail \
+	(__FILE__ + (sizeof(__FILE__) > 25 ? sizeof(__FILE__) - 25 : 0)) // the last 24 chars
+
+#define __ev_trace(level) \
+	(void)( (level) > EV_TRACE_MAX || (ev_put(ev_trace, 0, level, __LINE__, __ev_file_tail, strlen(__ev_file_tail)), 0) )
+
+#endif
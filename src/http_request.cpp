@@ -6,6 +6,7 @@
  *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
  *	All rights reserved.
  */
+#include "simd.h"
 #include "http_request.h"
 #include "trace.h"
 
@@ -47,28 +48,96 @@
 
  */
 
-//
-static bool parse_headers(const ch_range & _blob, ch_range & request, http_hdr_vec & headers)
+static void parse_uri(const ch_range & uri, uri_info & v)
 {
-	ch_range  blob = _blob;
-	ch_range_vec  lines;
+	v = uri_info();
+	v.path = uri;
+
+	if (! v.path.split_with("?", v.query))
+		return;
+		
+	v.query.split_with("#", v.frag);
+}
+
+static void parse_query(const ch_range & uri_query, qkv_pair_vec & args)
+{
+	args.clear();
+
+	if (uri_query.empty())
+		return;
 
-	blob.trim_r();
-	blob.tokenize("\r\n", lines, false); // false = don't coalesce 2+ "\r\n"
+	qkv_pair qkv;
 
-	if (lines.size() < 1)
+	for (auto & kv : uri_query.tokens("&", true))
 	{
-		trace_e("Header count < 1\n");
-		return false;
+		qkv.k = kv;
+		qkv.k.split_with("=", qkv.v);
+		args.push_back(qkv);
 	}
+}
+
+/*
+ *	The parser is fed whatever has arrived since the last call
+ *	and it picks up where it stopped, so every byte of the head
+ *	is looked at once. Positions are kept as offsets into the
+ *	conn.buf, because the buf may get reallocated in between the
+ *	calls, and they are converted into ranges at the very end.
+ */
+enum
+{
+	ps_req_line,    // Method SP Request-URI SP HTTP-Version
+	ps_line_start,  // at the start of a header line or of the final CRLF
+	ps_hdr_name,
+	ps_hdr_value,
+};
+
+static inline
+bool is_lws(char ch)
+{
+	return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static inline
+void extend(http_parser::span & s, size_t i)
+{
+	if (s.beg == (size_t)-1) s.beg = i;
+	s.end = i+1;
+}
 
-	request = lines[0];
-	headers.clear();
+static inline
+ch_range to_range(sk_conn & conn, const http_parser::span & s)
+{
+	return (s.beg == (size_t)-1) ? ch_range() : ch_range(&conn.buf[s.beg], s.end - s.beg);
+}
 
-	for (size_t i=1, n=lines.size(); i<n; i++)
+static bool feed(http_parser & ps, char ch, size_t i)
+{
+	switch (ps.state)
 	{
-		auto & h = lines[i];
-		http_hdr hdr;
+	case ps_req_line:
+
+		if (ch == ' ') // treat multiple spaces as one
+		{
+			ps.in_tok = false;
+			return true;
+		}
+
+		if (! ps.in_tok)
+		{
+			if (ps.toks == 3)
+			{
+				trace_e("Invalid request line\n");
+				return false;
+			}
+
+			ps.req[ps.toks++].beg = i;
+			ps.in_tok = true;
+		}
+
+		ps.req[ps.toks-1].end = i+1;
+		return true;
+
+	case ps_line_start:
 
 		/*
 		 *	"Header field values can be folded onto 
@@ -77,101 +146,202 @@ static bool parse_headers(const ch_range & _blob, ch_range & request, http_hdr_v
 		 *
 		 *	We don't support these.
 		 */
-		if (h.starts_with(" ") || h.starts_with("\t"))
+		if (ch == ' ' || ch == '\t')
 		{
 			trace_e("Multi-line header\n");
 			return false;
 		}
 
-		hdr.name = h;
-		if (! hdr.name.split_with(":", hdr.value))
-		{
-			trace_w("Invalid header [%.*s], skipped\n", __str(h));
-			return false;
-		}
+		ps.hdr = http_parser::header();
+		ps.hdr.raw.beg = i;
+		ps.state = ps_hdr_name;
 
-		hdr.name.trim();
-		hdr.value.trim();
+		// fall through
 
-		headers.push_back(hdr);
-	}
+	case ps_hdr_name:
 
-	return true;
-}
+		if (ch == ':')
+			ps.state = ps_hdr_value;
+		else
+		if (! is_lws(ch))
+			extend(ps.hdr.name, i);
 
-static bool parse_req_line(const ch_range & str, http_req & v)
-{
-	ch_range_vec  parts;
-	int i = 0;
+		return true;
 
-	str.tokenize(" ", parts, true); // true = treat multiple spaces as one
+	case ps_hdr_value:
 
-	if (parts.size() != 3)
-		return false;
+		if (! is_lws(ch))
+			extend(ps.hdr.value, i);
 
-	v.verb  = parts[0];
-	v.uri   = parts[1];
-	v.proto = parts[2];
+		return true;
+	}
 
-	return true;
+	__enforce(false);
+	return false;
 }
 
-static void parse_uri(const ch_range & uri, uri_info & v)
+/*
+ *	Switches on the length and then checks the name in full
+ */
+static const char * known_hdrs[hh_count] =
 {
-	v = uri_info();
-	v.path = uri;
+	"connection",
+	"content-length",
+	"content-type",
+	"expect",
+	"host",
+	"transfer-encoding",
+	"x-access-token",
+};
+
+static int classify_header(const ch_range & name)
+{
+	int id;
 
-	if (! v.path.split_with("?", v.query))
-		return;
-		
-	v.query.split_with("#", v.frag);
+	switch (name.size)
+	{
+	case  4: id = hh_host;              break;
+	case  6: id = hh_expect;            break;
+	case 10: id = hh_connection;        break;
+	case 12: id = hh_content_type;      break;
+	case 14: id = ((name.data[0] | 0x20) == 'c') ? hh_content_length : hh_x_access_token; break;
+	case 17: id = hh_transfer_encoding; break;
+	default: return hh_none;
+	}
+
+	return _strnicmp(name.data, known_hdrs[id], name.size) ? hh_none : id;
 }
 
-static void parse_query(const ch_range & uri_query, qkv_pair_vec & args)
+/*
+ *	i is the offset of the CR, returns -1 on errors, +1 on
+ *	reaching the end of the head and 0 otherwise
+ */
+static int feed_eol(sk_conn & conn, http_parser & ps, size_t i)
 {
-	args.clear();
+	switch (ps.state)
+	{
+	case ps_req_line:
 
-	if (uri_query.empty())
-		return;
+		if (ps.toks != 3)
+		{
+			trace_e("Invalid request line\n");
+			return -1;
+		}
 
-	ch_range_vec kvs;
-	qkv_pair qkv;
+		ps.state = ps_line_start;
+		return 0;
+
+	case ps_line_start:
+
+		return +1;
+
+	case ps_hdr_name:
+
+		ps.hdr.raw.end = i;
+		trace_w("Invalid header [%.*s], skipped\n", __str(to_range(conn, ps.hdr.raw)));
+		return -1;
+
+	case ps_hdr_value:
+
+		ps.hdr.raw.end = i;
+		ps.hdr.known = classify_header(to_range(conn, ps.hdr.name));
+		ps.hdrs.push_back(ps.hdr);
+		ps.state = ps_line_start;
+		return 0;
+	}
+
+	__enforce(false);
+	return -1;
+}
+
+static int parse_head(sk_conn & conn, http_parser & ps)
+{
+	char * buf = &conn.buf[0];
+	int rc;
 
-	uri_query.tokenize("&", kvs, true);
+	// the CRLF may be split across the reads, hence ps.cr
 
-	for (auto & kv : kvs)
+	for ( ; ps.at < conn.fill; ps.at++)
 	{
-		qkv.k = kv;
-		qkv.k.split_with("=", qkv.v);
-		args.push_back(qkv);
+		char ch = buf[ps.at];
+
+		if (ps.cr)
+		{
+			ps.cr = false;
+
+			if (ch == '\n')
+			{
+				rc = feed_eol(conn, ps, ps.at-1);
+				if (rc < 0)
+					return -1;
+
+				if (rc > 0)
+				{
+					ps.at++;
+					return +1;
+				}
+
+				continue;
+			}
+
+			if (! feed(ps, '\r', ps.at-1)) // a lone CR is just data
+				return -1;
+		}
+
+		if (ch == '\r')
+		{
+			ps.cr = true;
+			continue;
+		}
+
+		if (! feed(ps, ch, ps.at))
+			return -1;
 	}
+
+	return 0; // not yet
 }
 
 //
 int parse_http_request(sk_conn & conn, http_req & req)
 {
-	ch_range  blob;
-	ch_range  req_line;
+	http_parser & ps = req.parser;
 	uri_info  uri;
-	size_t    eoh;
+	int rc;
 
-	eoh = conn.buf.find("\r\n\r\n");
-	if (eoh == -1)
-		return 0; // not yet
+	rc = parse_head(conn, ps);
+	if (rc <= 0)
+	{
+		if (rc < 0)
+			trace_e("Unparsable headers\n");
+
+		return rc;
+	}
 
-	trace_v("Header break @ %d\n", eoh);
+	conn.pos = ps.at;
 
-	blob = ch_range( &conn.buf[0], eoh );
-	conn.pos = eoh + 4;
+	trace_v("Header break @ %zu\n", conn.pos - 4);
 
 	//
-	if (! parse_headers(blob, req_line, req.headers))
+	req.verb  = to_range(conn, ps.req[0]);
+	req.uri   = to_range(conn, ps.req[1]);
+	req.proto = to_range(conn, ps.req[2]);
+
+	req.headers.resize(ps.hdrs.size());
+
+	for (size_t i=0; i<ps.hdrs.size(); i++)
 	{
-		trace_e("Unparsable headers\n");
-		return -1;
+		auto & h = req.headers[i];
+
+		h.raw   = to_range(conn, ps.hdrs[i].raw);
+		h.name  = to_range(conn, ps.hdrs[i].name);
+		h.value = to_range(conn, ps.hdrs[i].value);
+		h.known = ps.hdrs[i].known;
+
+		if (h.known != hh_none && ! req.known[h.known])
+			req.known[h.known] = &h;
 	}
 
-	trace_v("req_line [%.*s]\n", __str(req_line));
+	trace_v("req_line [%.*s %.*s %.*s]\n", __str(req.verb), __str(req.uri), __str(req.proto));
 	for (auto & h : req.headers)
 		trace_v("header   [%-30.*s] [%.*s]\n", __str(h.name), __str(h.value));
 
@@ -181,12 +351,6 @@ int parse_http_request(sk_conn & conn, http_req & req)
 		return -1;
 	}
 
-	if (! parse_req_line(req_line, req))
-	{
-		trace_e("Invalid request line\n");
-		return -1;
-	}
-
 	trace_i("Parsed as [%.*s] [%.*s] [%.*s]\n", __str(req.verb), __str(req.uri), __str(req.proto));
 
 	parse_uri(req.uri, uri);
@@ -203,7 +367,82 @@ int parse_http_request(sk_conn & conn, http_req & req)
 }
 
 /*
+ *	Consumes 'in' up to the end of the next piece of a value,
+ *	which is then percent-decoded in place and returned. Up to 2
+ *	trailing bytes may be left in 'in' if they look like a split
+ *	%xx escape, and these are to be fed again, followed by more
+ *	data. 'last' means that 'in' runs up to the end of the form.
+ */
+bool form_reader::next(ch_range & in, bool last, ch_range & piece)
+{
+	char * amp;
+	size_t n, hold;
+
+	if (ended)
+	{
+		key.clear();
+		value = false;
+		ended = false;
+	}
+
+	while (! value)
+	{
+		char * sep;
+
+		if (! in.size)
+			return false;
+
+		sep = in.find_first_of("=&");
+		n = sep ? sep - in.data : in.size;
+
+		if (key.size() < max_key)
+			key.append(in.data, (n < max_key - key.size()) ? n : max_key - key.size());
+
+		if (! sep)
+		{
+			in.advance_by(n);
+			return false;
+		}
+
+		in.advance_by(n + 1);
+
+		if (*sep == '&')
+			key.clear(); // no value, no interest
+		else
+			value = true;
+	}
+
+	amp  = in.find('&');
+	n    = amp ? amp - in.data : in.size;
+	hold = 0;
+
+	if (! amp && ! last)
+	{
+		if (n >= 2 && in.data[n-2] == '%') hold = 2; else
+		if (n >= 1 && in.data[n-1] == '%') hold = 1;
+
+		if (n == hold)
+			return false;
+	}
+
+	piece = ch_range(in.data, n - hold);
+	percent_decode(piece);
+
+	in.advance_by(n - hold);
+
+	if (amp)
+		in.advance_by(1);
+
+	ended = amp || last;
+	return true;
+}
+
+/*
+ *	percent_decode
  *
+ *	All variants decode in place and produce identical output -
+ *	a '%' followed by two hex digits becomes a byte, everything
+ *	else, including malformed escapes, is copied as is.
  */
 static inline
 bool from_hex(char ch, uint8_t & val)
@@ -214,12 +453,9 @@ bool from_hex(char ch, uint8_t & val)
 	return false;
 }
 
-void percent_decode(string & str)
+static inline
+char * decode_tail(char * dst, const char * src, const char * end)
 {
-	char * src = &str[0];
-	char * dst = &str[0];
-	char * end = src + str.size();
-
 	while (src < end)
 	{
 		if (*src == '%' && src+3 <= end)
@@ -239,7 +475,186 @@ void percent_decode(string & str)
 		src++;
 	}
 
-	if (dst != end)
-		str.resize(dst - &str[0]);
+	return dst;
+}
+
+size_t percent_decode_scalar(char * str, size_t len)
+{
+	return decode_tail(str, str, str + len) - str;
+}
+
+#ifdef HAS_X86_SIMD
+
+/*
+ *	AVX2 - decodes all escapes in a 16-byte block at once and
+ *	then squeezes out the hex digits with a pshufb.
+ *
+ *	There's no SSE2 variant. Without pshufb all it could do is
+ *	skip '%'-free blocks, and that benched slower than the plain
+ *	loop at every size, so pre-AVX2 CPUs get the scalar one.
+ */
+struct compact_lut
+{
+	uint8_t  shuf[256][8]; // indices of set bits
+	uint8_t  size[256];    // and their count
+
+	compact_lut()
+	{
+		for (int k=0; k<256; k++)
+		{
+			int n = 0;
+			for (int i=0; i<8; i++)
+				if (k & (1 << i))
+					shuf[k][n++] = i;
+
+			size[k] = n;
+			while (n < 8)
+				shuf[k][n++] = 0x80;
+		}
+	}
+};
+
+static const compact_lut & get_compact_lut()
+{
+	static compact_lut lut;
+	return lut;
+}
+
+__target_avx2 static inline
+__m128i from_hex_x16(__m128i v, __m128i & ok)
+{
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i a = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+	__m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i is_a = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+
+	ok = _mm_or_si128(is_d, is_a);
+
+	return _mm_or_si128(_mm_and_si128(is_d, d),
+	                    _mm_and_si128(is_a, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+__target_avx2
+size_t percent_decode_avx2(char * str, size_t len)
+{
+	const compact_lut & lut = get_compact_lut();
+
+	const __m256i pct32 = _mm256_set1_epi8('%');
+	const __m128i pct   = _mm_set1_epi8('%');
+	const char  * src = str;
+	const char  * end = str + len;
+	char        * dst = str;
+
+	uint32_t carry = 0; // hex digits of an escape from the previous block
+
+	// the block at 'src' needs 2 bytes past it for the last escape
+	while (end - src >= 18)
+	{
+		if (! carry && end - src >= 32)
+		{
+			__m256i w = _mm256_loadu_si256((const __m256i*)src);
+
+			if (! _mm256_movemask_epi8(_mm256_cmpeq_epi8(w, pct32)))
+			{
+				_mm256_storeu_si256((__m256i*)dst, w);
+				src += 32;
+				dst += 32;
+				continue;
+			}
+		}
+
+		__m128i  v   = _mm_loadu_si128((const __m128i*)src);
+		__m128i  out = v;
+		__m128i  esc = _mm_cmpeq_epi8(v, pct);
+		uint32_t e   = 0;
+
+		if (_mm_movemask_epi8(esc))
+		{
+			__m128i ok1, ok2;
+			__m128i hi = from_hex_x16(_mm_loadu_si128((const __m128i*)(src+1)), ok1);
+			__m128i lo = from_hex_x16(_mm_loadu_si128((const __m128i*)(src+2)), ok2);
+
+			esc = _mm_and_si128(esc, _mm_and_si128(ok1, ok2));
+			e = _mm_movemask_epi8(esc);
+
+			if (e)
+			{
+				// hi << 4 spills into the next byte's low nibble, hence the mask
+				__m128i val = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(hi, 4), _mm_set1_epi8((char)0xF0)), lo);
+				out = _mm_blendv_epi8(v, val, esc);
+			}
+		}
+
+		uint32_t drop = (e << 1) | (e << 2) | carry;
+
+		if (! drop)
+		{
+			// dst <= src, so this won't clobber anything unread
+			_mm_storeu_si128((__m128i*)dst, v);
+			src += 16;
+			dst += 16;
+			continue;
+		}
+
+		uint32_t keep = ~drop & 0xFFFF;
+
+		// each store ends at or before src+16, same as above
+		_mm_storel_epi64((__m128i*)dst, _mm_shuffle_epi8(out, _mm_loadl_epi64((const __m128i*)lut.shuf[keep & 0xFF])));
+		dst += lut.size[keep & 0xFF];
+
+		_mm_storel_epi64((__m128i*)dst, _mm_shuffle_epi8(_mm_srli_si128(out, 8), _mm_loadl_epi64((const __m128i*)lut.shuf[keep >> 8])));
+		dst += lut.size[keep >> 8];
+
+		// escapes at 14 and 15 spill into the next block
+		carry = drop >> 16;
+		src += 16;
+	}
+
+	src += lut.size[carry];
+
+	return decode_tail(dst, src, end) - str;
+}
+
+#else
+
+size_t percent_decode_avx2(char * str, size_t len) { return percent_decode_scalar(str, len); }
+
+#endif
+
+/*
+ *
+ */
+typedef size_t (* percent_decode_fn)(char * str, size_t len);
+
+static percent_decode_fn pick_percent_decode()
+{
+	if (cpu_has_avx2()) return percent_decode_avx2;
+	return percent_decode_scalar;
+}
+
+size_t percent_decode(char * str, size_t len)
+{
+	static const percent_decode_fn fn = pick_percent_decode();
+	return fn(str, len);
+}
+
+void percent_decode(ch_range & str)
+{
+	if (str.size)
+		str.size = percent_decode(str.data, str.size);
+}
+
+void percent_decode(string & str)
+{
+	size_t len;
+
+	if (str.empty())
+		return;
+
+	len = percent_decode(&str[0], str.size());
+
+	if (len != str.size())
+		str.resize(len);
 }
 
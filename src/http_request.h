@@ -11,6 +11,7 @@
 
 #include "socket_io.h"
 #include "ch_range.h"
+#include "arena.h"
 
 //
 struct uri_info
@@ -27,7 +28,25 @@ struct qkv_pair
 	ch_range  v;
 };
 
-typedef vector<qkv_pair> qkv_pair_vec;
+typedef arena_vec<qkv_pair> qkv_pair_vec;
+
+/*
+ *	Headers that the parser picks out as it goes, see http_req
+ */
+enum
+{
+	hh_none = -1,
+
+	hh_connection,
+	hh_content_length,
+	hh_content_type,
+	hh_expect,
+	hh_host,
+	hh_transfer_encoding,
+	hh_x_access_token,
+
+	hh_count
+};
 
 //
 struct http_hdr
@@ -36,13 +55,64 @@ struct http_hdr
 
 	ch_range  name;
 	ch_range  value;
+
+	int       known;  // hh_xxx
 };
 
-typedef vector<http_hdr> http_hdr_vec;
+typedef arena_vec<http_hdr> http_hdr_vec;
+
+//
+struct http_parser // parse_http_request() state
+{
+	struct span   // in conn.buf
+	{
+		size_t  beg;
+		size_t  end;
+
+		span() { beg = -1; end = -1; }
+	};
+
+	struct header
+	{
+		span  raw;
+		span  name;
+		span  value;
+		int   known;
+
+		header() { known = hh_none; }
+	};
+
+	int             state;
+	size_t          at;      // next byte to look at
+	bool            cr;      // the previous byte was a '\r'
+
+	span            req[3];  // verb, uri, proto
+	int             toks;
+	bool            in_tok;
+
+	header             hdr;  // current one
+	arena_vec<header>  hdrs;
+
+	http_parser(arena * mem) : hdrs(mem) { reset(); }
+
+	void reset()
+	{
+		state = 0;
+		at = 0;
+		cr = false;
+		req[0] = req[1] = req[2] = span();
+		toks = 0;
+		in_tok = false;
+		hdr = header();
+		hdrs.reset();
+	}
+};
 
 //
 struct http_req
 {
+	arena         mem;     // for everything below, see reset()
+
 	// 1st line
 	ch_range  verb;
 	ch_range  uri;
@@ -52,11 +122,53 @@ struct http_req
 	ch_range      path;    // uri.path
 	qkv_pair_vec  args;    // uri.query
 	http_hdr_vec  headers; // 2nd+ line
+	http_hdr    * known[hh_count]; // first of each, if any, in 'headers'
+
+	http_parser   parser;
+
+	http_req() : args(&mem), headers(&mem), parser(&mem) { memset(known, 0, sizeof known); }
+
+	ch_range * header(int id) { return known[id] ? &known[id]->value : NULL; }
+
+	void reset()
+	{
+		verb = uri = proto = path = ch_range();
+
+		args.reset();
+		headers.reset();
+		memset(known, 0, sizeof known);
+		parser.reset();
+
+		mem.reset();
+	}
+};
+
+/*
+ *	application/x-www-form-urlencoded body, fed in pieces of any
+ *	size as they come off the wire
+ */
+struct form_reader
+{
+	string  key;    // of the current field, up to max_key
+	bool    value;  // in the value part
+	bool    ended;  // the last piece returned completes the value
+
+	form_reader() { value = false; ended = false; }
+
+	bool next(ch_range & in, bool last, ch_range & piece);
+
+	static const size_t max_key = 64;
 };
 
 //
 int parse_http_request(sk_conn & conn, http_req & req);
 
-void percent_decode(string & str);
+void   percent_decode(string & str);
+void   percent_decode(ch_range & str);
+size_t percent_decode(char * str, size_t len); // in place, returns new length
+
+// specific variants, check cpu_has_xxx() first
+size_t percent_decode_scalar(char * str, size_t len);
+size_t percent_decode_avx2(char * str, size_t len);
 
 #endif
@@ -0,0 +1,178 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "metrics.h"
+#include "utils.h"
+
+#include <mutex>
+
+/*
+ *	A thread's counters. Only the owner writes to them, so the
+ *	atomics are just to keep the scraper's reads whole. Blocks
+ *	outlive their threads, the counts are cumulative.
+ */
+typedef std::atomic<uint64_t> mx_counter;
+
+struct mx_block
+{
+	mx_counter  accepted;
+	mx_counter  bytes_in;
+	mx_counter  bytes_out;
+	mx_counter  requests[mx_verbs][mx_routes][mx_codes];
+
+	struct
+	{
+		mx_counter  count[mx_hist::buckets];
+		mx_counter  sum;
+
+	} stages[mx_stages];
+
+	mx_block() { memset(this, 0, sizeof *this); }
+};
+
+static std::mutex           blocks_lock;
+static vector<mx_block*>    blocks;
+
+static thread_local mx_block * my_block = NULL;
+
+//
+static mx_block * get_block()
+{
+	if (! my_block)
+	{
+		std::lock_guard<std::mutex> lock(blocks_lock);
+
+		my_block = new mx_block;
+		blocks.push_back(my_block);
+	}
+
+	return my_block;
+}
+
+static inline void bump(mx_counter & c, uint64_t v)
+{
+	c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+/*
+ *	mx_hist
+ */
+size_t mx_hist::bucket_of(uint64_t usec)
+{
+	uint64_t x = usec ? usec - 1 : 0;
+	uint_t   e;
+
+	if (x < 4)
+		return (size_t)x;
+
+	if (x >> 32)
+		return buckets - 1;
+
+	for (e = 2; x >> (e + 1); e++);
+
+	return 4 + (e - 2) * 4 + ((x >> (e - 2)) & 3);
+}
+
+size_t mx_hist::bound_of(uint_t k)
+{
+	return (k < 2) ? ((size_t)1 << k) : 4 * k - 4;
+}
+
+void mx_hist::print(string & out, const char * name, const string & labels) const
+{
+	uint64_t cum = 0;
+	size_t   i = 0;
+
+	// exported at power-of-2 bounds, 1 us to 32 s
+
+	for (uint_t k=0; k<=25; k++)
+	{
+		for ( ; i < bound_of(k); i++)
+			cum += count[i];
+
+		out += stringf("%s_bucket{%s,le=\"%.6f\"} %llu\n", name, labels.c_str(), (double)(1ull << k) / 1e6, cum);
+	}
+
+	// the total is of the buckets rather than a counter of its
+	// own, so that it agrees with them even if read mid-update
+
+	for ( ; i < buckets; i++)
+		cum += count[i];
+
+	out += stringf("%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels.c_str(), cum);
+	out += stringf("%s_sum{%s} %.6f\n", name, labels.c_str(), sum / 1e6);
+	out += stringf("%s_count{%s} %llu\n", name, labels.c_str(), cum);
+}
+
+/*
+ *	recording
+ */
+void mx_accepted()
+{
+	bump(get_block()->accepted, 1);
+}
+
+void mx_bytes_in(size_t bytes)
+{
+	bump(get_block()->bytes_in, bytes);
+}
+
+void mx_bytes_out(size_t bytes)
+{
+	bump(get_block()->bytes_out, bytes);
+}
+
+void mx_request(int verb, int route, int code)
+{
+	__enforce(0 <= verb && verb < mx_verbs);
+	__enforce(0 <= route && route < mx_routes);
+	__enforce(0 <= code && code < mx_codes);
+
+	bump(get_block()->requests[verb][route][code], 1);
+}
+
+void mx_time(int stage, uint64_t usec)
+{
+	auto & h = get_block()->stages[stage];
+
+	bump(h.count[mx_hist::bucket_of(usec)], 1);
+	bump(h.sum, usec);
+}
+
+/*
+ *	scraping
+ */
+void mx_collect(mx_totals & out)
+{
+	std::lock_guard<std::mutex> lock(blocks_lock);
+
+	out = mx_totals();
+
+	for (auto b : blocks)
+	{
+		out.accepted  += b->accepted;
+		out.bytes_in  += b->bytes_in;
+		out.bytes_out += b->bytes_out;
+
+		for (size_t v=0; v<mx_verbs; v++)
+			for (size_t r=0; r<mx_routes; r++)
+				for (size_t c=0; c<mx_codes; c++)
+					out.requests[v][r][c] += b->requests[v][r][c];
+
+		for (size_t s=0; s<mx_stages; s++)
+		{
+			auto & src = b->stages[s];
+			auto & dst = out.stages[s];
+
+			for (size_t i=0; i<mx_hist::buckets; i++)
+				dst.count[i] += src.count[i];
+
+			dst.sum += src.sum;
+		}
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "types.h"
+
+#include <atomic>
+
+/*
+ *	Request counters and stage latency histograms, served by the
+ *	engine as GET /metrics.
+ *
+ *	Each thread records into a block of its own, so recording is
+ *	a plain load and store with no locked instructions and no
+ *	cache lines shared between threads. The blocks are summed up
+ *	only when scraped, see mx_collect().
+ */
+enum
+{
+	mx_headers,    // accepted or done with the previous request -> headers parsed
+	mx_body,       // headers -> the last byte of the payload
+	mx_decode,     // running the payload through the form reader
+	mx_queue,      // storage job waiting for a worker
+	mx_disk,       // storage job being worked on
+	mx_response,   // sending out the reply
+
+	mx_stages
+};
+
+enum
+{
+	mx_verbs  = 5,   // see the engine for what's what
+	mx_routes = 7,
+	mx_codes  = 8,
+};
+
+/*
+ *	HDR-style - values (usec) up to 4 are counted exactly, past
+ *	that each power-of-2 range is split into 4 sub-buckets. The
+ *	ranges are (2^k, 2^(k+1)], so that the power-of-2 bounds are
+ *	exact for the "le" of the export.
+ */
+struct mx_hist
+{
+	enum { buckets = 124 };  // up to 2^32 usec, the rest goes into the last one
+
+	uint64_t  count[buckets];
+	uint64_t  sum;          // usec
+
+	mx_hist() { memset(this, 0, sizeof *this); }
+
+	static size_t bucket_of(uint64_t usec);
+	static size_t bound_of(uint_t k); // first bucket past 2^k usec
+
+	void print(string & out, const char * name, const string & labels) const; // Prometheus text
+};
+
+struct mx_totals
+{
+	uint64_t  accepted;
+	uint64_t  bytes_in;
+	uint64_t  bytes_out;
+	uint64_t  requests[mx_verbs][mx_routes][mx_codes];
+	mx_hist   stages[mx_stages];
+
+	mx_totals() { accepted = bytes_in = bytes_out = 0; memset(requests, 0, sizeof requests); }
+};
+
+//
+void mx_accepted();
+void mx_bytes_in(size_t bytes);
+void mx_bytes_out(size_t bytes);
+void mx_request(int verb, int route, int code);
+void mx_time(int stage, uint64_t usec);
+
+void mx_collect(mx_totals & totals); // from all threads that recorded anything
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "routes.h"
+
+/*
+ *	Path patterns are lower-case and matched case-insensitively,
+ *	byte by byte against the request path as is, with "{u64}"
+ *	matching a whole segment of decimal digits that fits into 64
+ *	bits. Adding an endpoint is adding a row.
+ */
+struct api_route
+{
+	int          verb;   // vb_xxx
+	const char * path;
+	int          route;  // rt_xxx
+	const char * name;   // for the spans and the event log
+};
+
+static constexpr api_route api_routes[] =
+{
+	{ vb_put,    "/test",        rt_put_test,    "PUT /test"      },
+	{ vb_put,    "/config",      rt_put_config,  "PUT /config"    },
+	{ vb_put,    "/board/{u64}", rt_put_board,   "PUT /board"     },
+	{ vb_delete, "/board/{u64}", rt_del_board,   "DELETE /board"  },
+	{ vb_get,    "/metrics",     rt_get_metrics, "GET /metrics"   },
+	{ vb_get,    "/spans",       rt_get_spans,   "GET /spans"     },
+};
+
+static constexpr size_t route_rows = sizeof api_routes / sizeof api_routes[0];
+
+/*
+ *	compile-time checks
+ */
+static constexpr bool valid_pattern(const char * p)
+{
+	if (p[0] != '/' || p[1] < 'a' || 'z' < p[1]) // see route_index
+		return false;
+
+	for ( ; *p; p++)
+	{
+		if ('A' <= *p && *p <= 'Z')
+			return false;
+
+		if (*p != '{')
+			continue;
+
+		if (p[-1] != '/' || p[1] != 'u' || p[2] != '6' || p[3] != '4' || p[4] != '}' || (p[5] && p[5] != '/'))
+			return false;
+
+		p += 4;
+	}
+
+	return true;
+}
+
+static constexpr bool valid_routes()
+{
+	for (size_t i=0; i<route_rows; i++)
+	{
+		auto & r = api_routes[i];
+
+		if (r.verb <= vb_other || vb_count <= r.verb || ! valid_pattern(r.path))
+			return false;
+
+		if (r.route <= rt_none || rt_count <= r.route || ! r.name)
+			return false;
+
+		for (size_t k=0; k<i; k++)
+			if (api_routes[k].route == r.route)
+				return false;
+	}
+
+	return route_rows < 0xff;
+}
+
+static_assert(valid_routes(), "Malformed API route table");
+
+/*
+ *	The rows by the verb and the first letter of the path, so that
+ *	a lookup only tries the rows that can match - usually just one
+ */
+struct route_index
+{
+	static const size_t per_bucket = 4;
+
+	uint8_t  rows[vb_count][26][per_bucket + 1];  // ended by 0xff
+	bool     ok;                                  // none of the buckets overflowed
+};
+
+static constexpr route_index make_index()
+{
+	route_index x = {};
+
+	for (size_t v=0; v<vb_count; v++)
+		for (size_t c=0; c<26; c++)
+			for (size_t k=0; k<=route_index::per_bucket; k++)
+				x.rows[v][c][k] = 0xff;
+
+	x.ok = true;
+
+	for (size_t i=0; i<route_rows; i++)
+	{
+		size_t v = api_routes[i].verb;
+		size_t c = api_routes[i].path[1] - 'a';
+		size_t n = 0;
+
+		while (x.rows[v][c][n] != 0xff)
+			n++;
+
+		if (n == route_index::per_bucket)
+			x.ok = false;
+		else
+			x.rows[v][c][n] = (uint8_t)i;
+	}
+
+	return x;
+}
+
+static constexpr route_index routes = make_index();
+
+static_assert(routes.ok, "Too many API routes with the same verb and first letter");
+
+struct route_names
+{
+	const char * name[rt_count];
+};
+
+static constexpr route_names make_names()
+{
+	route_names x = {};
+
+	x.name[rt_none] = "";
+
+	for (size_t i=0; i<route_rows; i++)
+		x.name[ api_routes[i].route ] = api_routes[i].name;
+
+	return x;
+}
+
+static constexpr route_names names = make_names();
+
+static constexpr bool all_named()
+{
+	for (size_t i=0; i<rt_count; i++)
+		if (! names.name[i])
+			return false;
+
+	return true;
+}
+
+static_assert(all_named(), "An rt_xxx with no row in the API route table");
+
+/*
+ *
+ */
+static bool match_path(const char * pat, const ch_range & path, ch_range & capture)
+{
+	const char * p   = path.data;
+	const char * end = path.data + path.size;
+	uint64_t     val;
+
+	while (*pat)
+	{
+		if (*pat == '{')
+		{
+			const char * q = p;
+			const char * max = (end - p > 20) ? p + 21 : end; // u64 is 20 digits tops
+
+			while (q < max && *q != '/')
+				q++;
+
+			capture = ch_range((char*)p, q - p);
+
+			if (! capture.to_u64(val))
+				return false;
+
+			p = q;
+			pat += 5;
+			continue;
+		}
+
+		if (p == end || (*p | ('A' <= *p && *p <= 'Z' ? 0x20 : 0)) != *pat)
+			return false;
+
+		p++;
+		pat++;
+	}
+
+	return p == end;
+}
+
+int find_route(int verb, const ch_range & path, ch_range & id)
+{
+	const uint8_t * row;
+	uint8_t         c;
+
+	if (verb < 0 || vb_count <= verb || path.size < 2 || path.data[0] != '/')
+		return rt_none;
+
+	c = (uint8_t)(path.data[1] | 0x20) - 'a';
+	if (c >= 26)
+		return rt_none;
+
+	for (row = routes.rows[verb][c]; *row != 0xff; row++)
+		if (match_path(api_routes[*row].path, path, id))
+			return api_routes[*row].route;
+
+	return rt_none;
+}
+
+const char * route_name(int route)
+{
+	return (0 <= route && route < rt_count) ? names.name[route] : "?";
+}
@@ -0,0 +1,48 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _ROUTES_H_
+#define _ROUTES_H_
+
+#include "types.h"
+#include "ch_range.h"
+
+/*
+ *	The API routes. They are listed in a table in routes.cpp,
+ *	which is checked and indexed at compile time.
+ */
+enum // also the mx_request() verb
+{
+	vb_other,
+	vb_options,
+	vb_get,
+	vb_put,
+	vb_delete,
+
+	vb_count
+};
+
+enum // also the mx_request() route
+{
+	rt_none,
+	rt_put_test,
+	rt_put_config,
+	rt_put_board,
+	rt_del_board,
+	rt_get_metrics,
+	rt_get_spans,
+
+	rt_count
+};
+
+// rt_xxx, 'id' is set to the "{u64}" segment if there's one
+int find_route(int verb, const ch_range & path, ch_range & id);
+
+const char * route_name(int route); // "PUT /board", "" for rt_none
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "simd.h"
+
+#ifdef HAS_X86_SIMD
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static void cpuid(int leaf, int r[4])
+{
+	__cpuidex(r, leaf, 0);
+}
+
+static uint64_t xgetbv()
+{
+	return _xgetbv(0);
+}
+
+#else
+#include <cpuid.h>
+
+static void cpuid(int leaf, int r[4])
+{
+	__cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+}
+
+static uint64_t xgetbv()
+{
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
+
+//
+struct cpu_features
+{
+	bool  sse2;
+	bool  avx2;
+
+	cpu_features()
+	{
+		int r[4] = { 0 };
+		int max;
+
+		sse2 = avx2 = false;
+
+		cpuid(0, r);
+		max = r[0];
+
+		if (max < 1)
+			return;
+
+		cpuid(1, r);
+
+		sse2 = (r[3] & (1 << 26)) != 0;
+
+		bool osxsave = (r[2] & (1 << 27)) != 0;
+		bool avx     = (r[2] & (1 << 28)) != 0;
+
+		if (max < 7 || ! osxsave || ! avx)
+			return;
+
+		if ((xgetbv() & 0x06) != 0x06) // XMM and YMM state
+			return;
+
+		cpuid(7, r);
+
+		avx2 = (r[1] & (1 << 5)) != 0;
+	}
+};
+
+static const cpu_features & get_cpu()
+{
+	static cpu_features cpu;
+	return cpu;
+}
+
+bool cpu_has_sse2() { return get_cpu().sse2; }
+bool cpu_has_avx2() { return get_cpu().avx2; }
+
+#else
+
+bool cpu_has_sse2() { return false; }
+bool cpu_has_avx2() { return false; }
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+/*
+ *	x86 vector extensions. The code using them is compiled in
+ *	unconditionally and the variant to run is picked at run-time
+ *	based on what the CPU supports.
+ *
+ *	Intrinsics headers go first, before __D from types.h.
+ */
+#if defined _M_IX86 || defined _M_X64 || defined __i386__ || defined __x86_64__
+#  define HAS_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+#include "types.h"
+
+#ifdef _MSC_VER
+#  define __target_avx2
+#else
+#  define __target_avx2   __attribute__((target("avx2")))
+#endif
+
+/*
+ *	bit tricks
+ */
+#ifdef _MSC_VER
+#include <intrin.h>
+inline int ctz32(uint32_t x) { unsigned long i; _BitScanForward(&i, x); return (int)i; }
+#else
+inline int ctz32(uint32_t x) { return __builtin_ctz(x); }
+#endif
+
+/*
+ *	cpu features
+ */
+bool cpu_has_sse2();
+bool cpu_has_avx2();  // and the OS saving the YMM state
+
+#endif
@@ -10,10 +10,48 @@
 #include "trace.h"
 
 //
-void sk_conn::replenish_buf()
+buf_pool sk_bufs;
+
+//
+void sk_conn::alloc_buf()
+{
+	__enforce(! buf.ptr);
+
+	buf.cap = buf_pool::min_size;
+	buf.ptr = sk_bufs.get(buf.cap);
+}
+
+void sk_conn::replenish_buf(size_t cap)
+{
+	size_t size;
+
+	if (fill < buf.cap || buf.cap >= cap)
+		return;
+
+	size = (2*buf.cap < cap) ? 2*buf.cap : cap;
+
+	buf.ptr = sk_bufs.grow(buf.ptr, buf.cap, fill, size);
+	buf.cap = size;
+}
+
+void sk_conn::trim_buf()
 {
-	if (fill == buf.size())
-		buf.resize( 2*buf.size() );
+	if (buf.cap <= buf_pool::min_size || fill > buf_pool::min_size)
+		return;
+
+	buf.ptr = sk_bufs.grow(buf.ptr, buf.cap, fill, buf_pool::min_size);
+	buf.cap = buf_pool::min_size;
+}
+
+void sk_conn::discard(size_t bytes)
+{
+	__enforce(bytes <= fill);
+
+	if (bytes < fill)
+		memmove(&buf[0], &buf[bytes], fill - bytes);
+
+	fill -= bytes;
+	pos = 0;
 }
 
 void sk_conn::clear()
@@ -22,11 +60,61 @@ void sk_conn::clear()
 	closesocket(sk);
 
 	sk = -1;
-	buf.clear();
+	sk_bufs.put(buf.ptr, buf.cap);
+	buf.ptr = NULL;
+	buf.cap = 0;
 	fill = 0;
 	pos = 0;
 }
 
+//
+bool sk_waker::init()
+{
+	sockaddr_in addr = { AF_INET };
+	int alen = sizeof(addr);
+
+	__enforce(sk == -1);
+
+	sk = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sk == -1)
+		return wsa_error("socket");
+
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sk, (sockaddr*)&addr, sizeof addr) < 0 ||
+	    getsockname(sk, (sockaddr*)&addr, &alen) < 0 ||
+	    connect(sk, (sockaddr*)&addr, sizeof addr) < 0)
+	{
+		wsa_error("sk_waker");
+		closesocket(sk);
+		sk = -1;
+		return false;
+	}
+
+	if (! sk_unblock(sk))
+	{
+		closesocket(sk);
+		sk = -1;
+		return false;
+	}
+
+	return true;
+}
+
+void sk_waker::wake()
+{
+	// if this fails, then there's a wake-up pending already
+	send(sk, "", 1, 0);
+}
+
+void sk_waker::drain()
+{
+	char buf[64];
+
+	while (recv(sk, buf, sizeof buf, 0) > 0)
+		;
+}
+
 
 //
 int sk_wait(SOCKET sk, int what, int timeout_sec)
@@ -115,6 +203,36 @@ int sk_recv(sk_conn & conn, int timeout_sec)
 }
 
 //
+int sk_send_some(sk_conn & conn, ch_range & buf)
+{
+	__enforce(conn.sk != -1);
+	__enforce(buf.size);
+
+	int rc;
+
+	rc = send(conn.sk, buf.data, (int)buf.size, 0);
+
+	if (rc > 0)
+	{
+		trace_v("sk_send_some() -> sent %d bytes, out of %zu\n", rc, buf.size);
+
+		__enforce(rc <= (int)buf.size);
+		buf.advance_by(rc);
+	}
+	else
+	if (rc < 0 && sk_send_fatal())
+	{
+		wsa_error("send");
+		rc = -1; // error
+	}
+	else
+	{
+		rc = -2; // no room
+	}
+
+	return rc;
+}
+
 int sk_send(sk_conn & conn, const ch_range & _buf, int timeout_sec)
 {
 	ch_range buf = _buf;
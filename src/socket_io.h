@@ -12,18 +12,56 @@
 #include "types.h"
 #include "ch_range.h"
 #include "trace.h"
+#include "buf_pool.h"
+
+//
+struct sk_buf // from sk_bufs
+{
+	char  * ptr;
+	size_t  cap;
+
+	sk_buf() { ptr = NULL; cap = 0; }
+
+	sk_buf(const sk_buf &) = delete;
+	void operator = (const sk_buf &) = delete;
+
+	size_t size() const { return cap; }
+	char * data() const { return ptr; }
+	char & operator [] (size_t i) const { return ptr[i]; }
+};
+
+extern buf_pool sk_bufs; // engine thread only
 
 //
 struct sk_conn
 {
 	SOCKET  sk;
-	string  buf;
+	sk_buf  buf;
 	size_t  fill; // of the buf
 	size_t  pos;  // in the buf
 
 	sk_conn() { sk = -1; fill = 0; pos = 0; }
-	void replenish_buf();
-	void clear();
+	void alloc_buf();               // on accept
+	void replenish_buf(size_t cap); // grows a full buf, up to cap
+	void trim_buf();                // shrinks the buf back if the data fits
+	void discard(size_t bytes);     // drops the head of the buf, resets pos
+	void clear();                   // closes the socket, returns the buf
+};
+
+/*
+ *	A loopback datagram socket that other threads can poke to
+ *	get a select() on the owning thread to return
+ */
+struct sk_waker
+{
+	SOCKET  sk;
+
+	sk_waker() { sk = -1; }
+	~sk_waker() { if (sk != -1) closesocket(sk); }
+
+	bool init();
+	void wake();
+	void drain();
 };
 
 //
@@ -39,6 +77,7 @@ int sk_recv(sk_conn & conn);
 int sk_recv(sk_conn & conn, int timeout_sec);
 
 int sk_send(sk_conn & conn, const ch_range & buf, int timeout_sec = 1);
+int sk_send_some(sk_conn & conn, ch_range & buf); // one send(), advances 'buf', -2 if it'd block
 
 /*
  *	inlines
@@ -0,0 +1,153 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "spans.h"
+#include "utils.h"
+
+#include <atomic>
+#include <mutex>
+
+/*
+ *	A thread's spans. Only the owner writes, the exporter reads
+ *	the records back and drops those that changed under it - a
+ *	record's 'seq' is zeroed before it's filled in and set once
+ *	it's done.
+ */
+struct sp_record
+{
+	std::atomic<uint64_t>  seq;    // 1-based
+	uint64_t               t0;
+	uint64_t               t1;
+	const char           * name;   // static strings only
+	const char           * route;
+	uint32_t               conn;
+};
+
+struct sp_ring
+{
+	enum { size = 8192 };  // power of 2
+
+	std::atomic<uint64_t>  head;   // records written
+	dword                  thread;
+	sp_record              recs[size];
+
+	sp_ring() { memset(this, 0, sizeof *this); }
+};
+
+static std::mutex         rings_lock;
+static vector<sp_ring*>   rings;
+
+static thread_local sp_ring * my_ring = NULL;
+
+// the clock -> usec, measured against QPC over the run
+
+struct sp_origin
+{
+	uint64_t  clock;
+	uint64_t  usec;
+
+	sp_origin() { clock = sp_clock(); usec = get_usec(); }
+};
+
+static sp_origin origin;
+
+//
+static sp_ring * get_ring()
+{
+	if (! my_ring)
+	{
+		std::lock_guard<std::mutex> lock(rings_lock);
+
+		my_ring = new sp_ring;
+		my_ring->thread = GetCurrentThreadId();
+		rings.push_back(my_ring);
+	}
+
+	return my_ring;
+}
+
+void sp_put(const char * name, uint32_t conn, const char * route, uint64_t t0, uint64_t t1)
+{
+	sp_ring   * ring = get_ring();
+	uint64_t    seq = ring->head.load(std::memory_order_relaxed);
+	sp_record & r = ring->recs[seq & (sp_ring::size - 1)];
+
+	r.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	r.t0    = t0;
+	r.t1    = t1;
+	r.name  = name;
+	r.route = route;
+	r.conn  = conn;
+
+	r.seq.store(seq + 1, std::memory_order_release);
+	ring->head.store(seq + 1, std::memory_order_release);
+}
+
+/*
+ *	One track per connection, "tid" being the connection serial,
+ *	so that a request's spans line up regardless of the thread
+ *	they ran on. The thread goes into the args.
+ */
+void sp_export(string & json)
+{
+	vector<sp_ring*> all;
+	uint64_t  clock = sp_clock();
+	uint64_t  usec  = get_usec();
+	double    rate;       // clock ticks per usec
+	bool      first = true;
+
+	{
+		std::lock_guard<std::mutex> lock(rings_lock);
+		all = rings;
+	}
+
+	rate = (usec > origin.usec) ? (double)(clock - origin.clock) / (usec - origin.usec) : 1.;
+
+	json += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+	for (auto ring : all)
+	{
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t from = (head > sp_ring::size) ? head - sp_ring::size : 0;
+
+		for (uint64_t i = from; i < head; i++)
+		{
+			sp_record & r = ring->recs[i & (sp_ring::size - 1)];
+			uint64_t    seq, t0, t1;
+			const char * name, * route;
+			uint32_t    conn;
+
+			seq = r.seq.load(std::memory_order_acquire);
+			if (seq != i + 1)
+				continue; // overwritten since
+
+			t0    = r.t0;
+			t1    = r.t1;
+			name  = r.name;
+			route = r.route;
+			conn  = r.conn;
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (r.seq.load(std::memory_order_relaxed) != seq)
+				continue;
+
+			json += stringf("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+			                "\"args\":{\"route\":\"%s\",\"thread\":%lu}}",
+				first ? "" : ",\n", name, conn,
+				(int64_t)(t0 - origin.clock) / rate, (t1 - t0) / rate,
+				route ? route : "", ring->thread);
+
+			first = false;
+		}
+	}
+
+	json += "\n]}\n";
+}
@@ -0,0 +1,57 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _SPANS_H_
+#define _SPANS_H_
+
+#include "simd.h"   // HAS_X86_SIMD, goes first
+#include "types.h"
+
+/*
+ *	Timed spans of what each request's time goes on, tagged with
+ *	the connection serial and the route. Each thread records into
+ *	a ring of its own, overwriting the oldest spans, and the rings
+ *	are read on demand as Chrome trace-event JSON, see sp_export().
+ *
+ *	The clock is the TSC where there is one, it is converted to
+ *	usec only when exported.
+ */
+inline uint64_t sp_clock()
+{
+#ifdef HAS_X86_SIMD
+	return __rdtsc();
+#else
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+#endif
+}
+
+void sp_put(const char * name, uint32_t conn, const char * route, uint64_t t0, uint64_t t1);
+
+void sp_export(string & json); // appends
+
+/*
+ *	Times the rest of the scope
+ */
+struct sp_scope
+{
+	const char * name;
+	uint32_t     conn;
+	const char * route;
+	uint64_t     t0;
+
+	sp_scope(const char * _name, uint32_t _conn, const char * _route)
+	{
+		name = _name; conn = _conn; route = _route; t0 = sp_clock();
+	}
+
+	~sp_scope() { sp_put(name, conn, route, t0, sp_clock()); }
+};
+
+#endif
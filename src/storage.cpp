@@ -0,0 +1,398 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#include "storage.h"
+#include "config.h"
+#include "utils.h"
+#include "trace.h"
+#include "metrics.h"
+#include "spans.h"
+
+//
+store_pool::store_pool()
+{
+	enough = false;
+	on_done = NULL;
+	ctx = NULL;
+	started = 0;
+}
+
+store_pool::~store_pool()
+{
+	stop();
+}
+
+bool store_pool::start(size_t workers, void (* _on_done)(void *), void * _ctx)
+{
+	__enforce(threads.empty());
+	__enforce(workers);
+
+	enough = false;
+	on_done = _on_done;
+	ctx = _ctx;
+
+	stats = store_stats();
+	stats.workers = workers;
+	started = get_usec();
+
+	for (size_t i=0; i<workers; i++)
+		threads.emplace_back(&store_pool::work, this);
+
+	trace_v("Storage pool started, %zu workers\n", workers);
+	return true;
+}
+
+void store_pool::stop()
+{
+	if (threads.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mx);
+		enough = true;
+	}
+
+	cv.notify_all();
+
+	for (auto & t : threads)
+		t.join();
+
+	threads.clear();
+
+	//
+	store_stats st;
+
+	get_stats(st);
+
+	trace_i("Storage: %llu jobs, %llu failed, queue peak %zu, latency avg %llu us, max %llu us, workers %.1f%% busy\n",
+		st.jobs, st.failed, st.queued_max,
+		st.jobs ? (st.wait_usec + st.work_usec) / st.jobs : 0, st.latency_max,
+		st.uptime_usec ? 100. * st.work_usec / st.workers / st.uptime_usec : 0.);
+}
+
+void store_pool::submit(store_job * job)
+{
+	__enforce(! threads.empty());
+
+	job->ok = false;
+	job->error = NULL;
+	job->missing = false;
+	job->queued = get_usec();
+
+	if (job->type == store_job::put_board || job->type == store_job::del_board)
+		job->key = job->area + L"\\" + to_wstr(job->board);
+	else
+	if (job->type == store_job::put_config)
+		job->key = job->area;
+	else
+	if (job->type == store_job::put_ini)
+		job->key = L"settings.ini";
+	else
+		job->key.clear(); // temp files are the connection's own
+
+	{
+		std::lock_guard<std::mutex> lock(mx);
+
+		__enforce(! enough);
+
+		queue.push_back(job);
+
+		if (stats.queued_max < queue.size())
+			stats.queued_max = queue.size();
+	}
+
+	cv.notify_one();
+}
+
+void store_pool::collect(store_job_vec & out)
+{
+	std::lock_guard<std::mutex> lock(mx);
+
+	out.clear();
+	out.swap(done);
+}
+
+void store_pool::get_stats(store_stats & out)
+{
+	std::lock_guard<std::mutex> lock(mx);
+
+	out = stats;
+	out.queued = queue.size();
+	out.uptime_usec = started ? get_usec() - started : 0;
+}
+
+/*
+ *	private
+ */
+store_job * store_pool::next_job()
+{
+	for (auto i = queue.begin(); i != queue.end(); i++)
+	{
+		store_job * job = *i;
+
+		if (job->key.size() && busy.count(job->key))
+			continue;
+
+		if (job->key.size())
+			busy.insert(job->key);
+
+		queue.erase(i);
+		return job;
+	}
+
+	return NULL;
+}
+
+void store_pool::work()
+{
+	std::unique_lock<std::mutex> lock(mx);
+
+	for (;;)
+	{
+		store_job * job;
+
+		while (! (job = next_job()) && ! (enough && queue.empty()))
+			cv.wait(lock);
+
+		if (! job)
+			break; // enough
+
+		lock.unlock();
+
+		job->started = get_usec();
+		{
+			sp_scope sp("store_job", job->conn, job->route);
+			exec(*job);
+		}
+		job->done = get_usec();
+
+		trace_v("Storage job done in %llu us, after %llu us in the queue\n",
+			job->done - job->started, job->started - job->queued);
+
+		mx_time(mx_queue, job->started - job->queued);
+		mx_time(mx_disk, job->done - job->started);
+
+		lock.lock();
+
+		stats.jobs++;
+		stats.failed += ! job->ok;
+		stats.wait_usec += job->started - job->queued;
+		stats.work_usec += job->done - job->started;
+
+		if (stats.latency_max < job->done - job->queued)
+			stats.latency_max = job->done - job->queued;
+
+		if (job->key.size())
+		{
+			busy.erase(job->key);
+			cv.notify_all(); // the jobs queued behind it
+		}
+
+		done.push_back(job);
+
+		if (on_done)
+			on_done(ctx);
+	}
+}
+
+/*
+ *	The file system calls, timed as spans of the job
+ */
+static bool make_path(const store_job & job, const wstring & path)
+{
+	sp_scope sp("make_path", job.conn, job.route);
+	return make_path(path);
+}
+
+static bool save_file(const store_job & job, const wstring & file, const ch_range & data)
+{
+	sp_scope sp("save_file", job.conn, job.route);
+	return save_file(file, data);
+}
+
+static bool append_file(const store_job & job, const wstring & file, const ch_range & data)
+{
+	sp_scope sp("append_file", job.conn, job.route);
+	return append_file(file, data);
+}
+
+static bool move_file(const store_job & job, const wstring & from, const wstring & to, dword flags = MOVEFILE_REPLACE_EXISTING)
+{
+	sp_scope sp("MoveFileEx", job.conn, job.route);
+	return MoveFileEx(from.c_str(), to.c_str(), flags) != 0;
+}
+
+/*
+ *	The data either goes straight into its file or, if there's a
+ *	temp file, gets appended to it and the temp is then moved in
+ *	place of the file.
+ */
+static bool put_data(const store_job & job, const wstring & file)
+{
+	wstring temp;
+
+	if (job.temp.empty())
+	{
+		if (save_file(job, file, job.data))
+			return true;
+
+		trace_e("Failed to save [%S]\n", file.c_str());
+		return false;
+	}
+
+	temp = conf.path + L"\\" + job.area + L"\\" + job.temp;
+
+	if (job.data.size && ! append_file(job, temp, job.data))
+	{
+		trace_e("Failed to append to [%S]\n", temp.c_str());
+		return false;
+	}
+
+	if (! move_file(job, temp, file))
+	{
+		trace_e("MoveFileEx() failed %lu\n", GetLastError());
+		trace_i("[%S] -> [%S]\n", temp.c_str(), file.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static bool del_board(store_job & job)
+{
+	wstring path = conf.path + L"\\" + job.area + L"\\" + to_wstr(job.board);
+	wstring arch = conf.path + L"\\" + job.area + L"\\$DeletedBoards";
+
+	if (! folder_exists(path))
+	{
+		if (job.held)
+		{
+			trace_i("Board was never written out, its held save is dropped\n");
+			return true;
+		}
+
+		trace_e("Non-existent board\n");
+		job.missing = true;
+		job.error = "Non-existent board";
+		return false;
+	}
+
+	if (! make_path(job, arch))
+	{
+		trace_e("Failed to create [%S] folder\n", arch.c_str());
+		job.error = "make_path() failed";
+		return false;
+	}
+
+	arch += L"\\" + to_wstr(job.board);
+
+	if (! move_file(job, path, arch, 0))
+	{
+		trace_e("MoveFileEx() failed %lu\n", GetLastError());
+		trace_i("[%S] -> [%S]\n", path.c_str(), arch.c_str());
+		job.error = "move_file() failed";
+		return false;
+	}
+
+	return true;
+}
+
+void store_pool::exec(store_job & job)
+{
+	wstring  path;
+	wstring  file;
+
+	if (job.type == store_job::del_board)
+	{
+		job.ok = del_board(job);
+		return;
+	}
+
+	if (job.type == store_job::put_ini)
+	{
+		job.ok = save_ini();
+		job.error = job.ok ? NULL : "save_ini() failed";
+		return;
+	}
+
+	path = conf.path + L"\\" + job.area;
+
+	if (job.type == store_job::put_board)
+		path += L"\\" + to_wstr(job.board);
+
+	if (! make_path(job, path))
+	{
+		trace_e("Failed to create [%S] folder\n", path.c_str());
+		job.error = "make_path() failed";
+		return;
+	}
+
+	if (job.type == store_job::append)
+	{
+		file = path + L"\\" + job.temp;
+
+		if (job.fresh ? ! save_file(job, file, job.data) : ! append_file(job, file, job.data))
+		{
+			trace_e("Failed to write to [%S]\n", file.c_str());
+			job.error = "append_file() failed";
+			return;
+		}
+
+		job.ok = true;
+		return;
+	}
+
+	if (job.type == store_job::put_config)
+	{
+		if (job.data.size || job.temp.size())
+		{
+			file = path + L"\\app-config.json";
+			if (! put_data(job, file))
+			{
+				job.error = "save_file() failed";
+				return;
+			}
+		}
+
+		job.ok = true;
+		return;
+	}
+
+	__enforce(job.type == store_job::put_board);
+
+	if (job.meta.size)
+	{
+		file = path + L"\\meta.json";
+		if (! save_file(job, file, job.meta))
+		{
+			trace_e("Failed to save [%S]\n", file.c_str());
+			job.error = "save_file() failed";
+			return;
+		}
+
+		trace_i("meta saved in [%S]\n", file.c_str());
+	}
+
+	if (job.data.size || job.temp.size())
+	{
+		wchar_t name[64] = { 0 };
+
+		wsprintf(name, L"rev-%08u.nbx", job.rev);
+		file = path + L"\\" + name;
+
+		if (! put_data(job, file))
+		{
+			job.error = "save_file() failed";
+			return;
+		}
+
+		trace_i("data saved in [%S]\n", file.c_str());
+	}
+
+	job.ok = true;
+}
@@ -0,0 +1,126 @@
+/*
+ *	This file is a part of the "Nullboard Backup Agent" source
+ *	code and it is distributed under the terms of 2-clause BSD
+ *	license.
+ *
+ *	Copyright (c) 2022 Alexander Pankratov, ap@swapped.ch.
+ *	All rights reserved.
+ */
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include "types.h"
+#include "ch_range.h"
+
+#include <set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+//
+struct store_job
+{
+	enum
+	{
+		put_config,   // data -> <area>\app-config.json
+		put_board,    // meta -> <area>\<board>\meta.json, data -> rev-<rev>.nbx
+		append,       // data -> <area>\<temp>
+		del_board,    // <area>\<board> -> <area>\$DeletedBoards\<board>
+		put_ini,      // conf -> settings.ini, see save_ini()
+	};
+
+	// in
+	int          type;
+	wstring      area;     // area folder, relative to conf.path
+	string       board;    // decimal board id, as it came in
+	uint_t       rev;
+	ch_range     meta;     // views into the submitter's buffer, which
+	ch_range     data;     // must stay put until the job is collected
+	wstring      temp;     // file in the area folder with the data so far, if any
+	bool         fresh;    // append - (re)create the temp file
+	bool         held;     // del_board - its save was held in memory, it may not be on disk
+	void       * owner;    // for the submitter's use
+	uint32_t     conn;     // for the spans
+	const char * route;    // ditto, static
+
+	// out
+	bool         ok;
+	const char * error;    // details for a failed job
+	bool         missing;  // del_board - no such board
+
+	// set by submit(), the jobs with the same key are run one
+	// at a time and in the order they came in
+	wstring      key;
+
+	// timing
+	uint64_t     queued;   // usec
+	uint64_t     started;
+	uint64_t     done;
+
+	store_job() { type = put_board; rev = 0; fresh = false; held = false; owner = NULL; conn = 0; route = NULL; ok = false; error = NULL; missing = false; queued = started = done = 0; }
+};
+
+typedef vector<store_job*> store_job_vec;
+
+//
+struct store_stats
+{
+	size_t    workers;
+	size_t    queued;        // current queue depth
+	size_t    queued_max;    // its high watermark
+	uint64_t  jobs;          // completed
+	uint64_t  failed;        // ... of which failed
+	uint64_t  wait_usec;     // total time spent in the queue
+	uint64_t  work_usec;     // total time spent by workers on jobs
+	uint64_t  latency_max;   // usec, queued -> done
+	uint64_t  uptime_usec;   // since start(), for utilisation = work_usec / (workers * uptime_usec)
+
+	store_stats() { memset(this, 0, sizeof *this); }
+};
+
+/*
+ *	A fixed set of worker threads fed through a queue of fully
+ *	parsed write jobs. Completed jobs are parked for collect()
+ *	and on_done() is called from the worker, so that the owner
+ *	could wake up and pick them up.
+ *
+ *	The jobs on the same board, or on the same area's config,
+ *	are run in order, one at a time. A worker takes the first
+ *	queued job that isn't behind one still being worked on.
+ */
+struct store_pool
+{
+	store_pool();
+	~store_pool();
+
+	bool start(size_t workers, void (* on_done)(void * ctx), void * ctx);
+	void stop(); // completes all queued jobs first
+
+	void submit(store_job * job);
+	void collect(store_job_vec & done);
+
+	void get_stats(store_stats & stats);
+
+private:
+	void work();
+	void exec(store_job & job);
+	store_job * next_job(); // under mx
+
+	//
+	std::mutex                mx;
+	std::condition_variable   cv;
+	std::deque<store_job*>    queue;
+	std::set<wstring>         busy;   // keys of the jobs being worked on
+	store_job_vec             done;
+	vector<std::thread>       threads;
+	bool                      enough;
+
+	void                   (* on_done)(void * ctx);
+	void                    * ctx;
+
+	store_stats               stats;
+	uint64_t                  started;
+};
+
+#endif
@@ -8,20 +8,295 @@
  */
 #include "trace.h"
 #include "config.h"
+#include "utils.h"
 
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/*
+ *	Each thread that traces gets its own single-producer ring. A
+ *	message is formatted on the stack and copied into the ring as
+ *	a 4-byte length followed by the text. If there's no room, it
+ *	is dropped and counted. The tracer's thread drains the rings
+ *	every few ms and reports the drop counts.
+ */
+struct trace_ring
+{
+	std::atomic<uint64_t>  head;   // advanced by the owner thread
+	std::atomic<uint64_t>  tail;   // ... by the tracer
+	std::atomic<uint64_t>  drops;
+	std::atomic<bool>      dead;   // the owner thread is gone
+
+	char  data[64*1024];           // power of 2
+
+	trace_ring() : head(0), tail(0), drops(0), dead(false) { }
+};
+
+struct trace_ring_ref
+{
+	trace_ring * ring;
+
+	~trace_ring_ref() { if (ring) ring->dead = true; }
+};
+
+static const size_t  max_message = 4096; // longer ones are cut
+
+static std::atomic<bool>         tracer_on(false);
+static std::thread               tracer;
+static std::mutex                tracer_lock;  // for the below
+static std::condition_variable   tracer_cv;
+static bool                      tracer_stop;
+static vector<trace_ring*>       rings;
+static HANDLE                    trace_file = INVALID_HANDLE_VALUE;
+
+static thread_local trace_ring_ref  my_ring;
+
+//
+static void write_out(const char * data, size_t size)
+{
+	DWORD bytes;
+
+	if (! size)
+		return;
+
+	if (trace_file == INVALID_HANDLE_VALUE)
+	{
+		fwrite(data, 1, size, stdout);
+		return;
+	}
+
+	WriteFile(trace_file, data, (DWORD)size, &bytes, NULL);
+}
+
+static trace_ring * get_ring()
+{
+	if (! my_ring.ring)
+	{
+		std::lock_guard<std::mutex> lock(tracer_lock);
+
+		my_ring.ring = new trace_ring;
+		rings.push_back(my_ring.ring);
+	}
+
+	return my_ring.ring;
+}
+
+static void ring_put(trace_ring * r, const char * msg, uint32_t len)
+{
+	const size_t cap = sizeof r->data;
+
+	uint64_t head = r->head.load(std::memory_order_relaxed);
+	uint64_t tail = r->tail.load(std::memory_order_acquire);
+	size_t   need = sizeof len + len;
+	size_t   at, part;
+
+	if (cap - (head - tail) < need)
+	{
+		r->drops.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const char * src[2]  = { (const char *)&len, msg };
+	size_t       size[2] = { sizeof len, len };
+
+	for (int i=0; i<2; i++)
+	{
+		at = head & (cap - 1);
+		part = (size[i] < cap - at) ? size[i] : cap - at;
+
+		memcpy(r->data + at, src[i], part);
+		memcpy(r->data, src[i] + part, size[i] - part);
+
+		head += size[i];
+	}
+
+	r->head.store(head, std::memory_order_release);
+}
+
+static void ring_get(trace_ring * r, string & out)
+{
+	const size_t cap = sizeof r->data;
+
+	uint64_t head = r->head.load(std::memory_order_acquire);
+	uint64_t tail = r->tail.load(std::memory_order_relaxed);
+	uint64_t drops;
+	size_t   at, part;
+
+	// the records may wrap around, but the text is copied as is,
+	// so it's just the bytes between the length fields
+
+	while (tail < head)
+	{
+		uint32_t len;
+
+		for (size_t i=0; i<sizeof len; i++)
+			((char*)&len)[i] = r->data[(tail + i) & (cap - 1)];
+
+		tail += sizeof len;
+
+		at = tail & (cap - 1);
+		part = (len < cap - at) ? len : cap - at;
+
+		out.append(r->data + at, part);
+		out.append(r->data, len - part);
+
+		tail += len;
+	}
+
+	r->tail.store(tail, std::memory_order_release);
+
+	drops = r->drops.exchange(0, std::memory_order_relaxed);
+	if (drops)
+	{
+		char buf[64];
+		snprintf(buf, sizeof buf, "w: %llu trace message(s) dropped\n", (unsigned long long)drops);
+		out += buf;
+	}
+}
+
+static void drain()
+{
+	vector<trace_ring*> all;
+	string out;
+
+	{
+		std::lock_guard<std::mutex> lock(tracer_lock);
+		all = rings;
+	}
+
+	for (auto r : all)
+		ring_get(r, out);
+
+	write_out(out.data(), out.size());
+
+	// rings of the threads that are gone are let go once empty
+
+	std::lock_guard<std::mutex> lock(tracer_lock);
+
+	for (size_t i=0; i<rings.size(); )
+	{
+		trace_ring * r = rings[i];
+
+		if (r->dead && r->tail == r->head)
+		{
+			rings[i] = rings.back();
+			rings.pop_back();
+			delete r;
+		}
+		else
+			i++;
+	}
+}
+
+static void tracer_main()
+{
+	std::unique_lock<std::mutex> lock(tracer_lock);
+
+	while (! tracer_stop)
+	{
+		tracer_cv.wait_for(lock, std::chrono::milliseconds(10));
+
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+}
+
+//
+bool start_tracer()
+{
+	__enforce(! tracer_on);
+
+	if (conf.trace_file.size())
+	{
+		trace_file = CreateFile(conf.trace_file.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (trace_file == INVALID_HANDLE_VALUE)
+			return api_error("CreateFile", "%s", to_utf8(conf.trace_file).c_str());
+	}
+
+	tracer_stop = false;
+	tracer = std::thread(tracer_main);
+	tracer_on = true;
+	return true;
+}
+
+void stop_tracer()
+{
+	if (! tracer_on)
+		return;
+
+	tracer_on = false;
+
+	{
+		std::lock_guard<std::mutex> lock(tracer_lock);
+		tracer_stop = true;
+	}
+
+	tracer_cv.notify_one();
+	tracer.join();
+
+	drain(); // whatever came in while it was stopping
+
+	if (trace_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(trace_file);
+		trace_file = INVALID_HANDLE_VALUE;
+	}
+}
+
+//
 void vtracef(uint_t level, const char * prefix, const char * format, va_list args, const char * suffix = NULL)
 {
+	char   buf[max_message];
+	size_t len = 0;
+	int    n;
+
 	if (level > conf.trace)
 		return;
 
-	if (prefix) printf("%s", prefix);
-	
-	vprintf(format, args);
+	if (! tracer_on)
+	{
+		if (prefix) printf("%s", prefix);
+
+		vprintf(format, args);
+
+		if (suffix) printf("%s", suffix);
+		return;
+	}
+
+	if (prefix)
+		len = strlen(prefix);
+
+	memcpy(buf, prefix, len);
+
+	n = vsnprintf(buf + len, sizeof buf - len, format, args);
+	if (n < 0)
+		return;
+
+	if (len + n < sizeof buf)
+	{
+		len += n;
+	}
+	else
+	{
+		static const char cut[] = "...\n";
+
+		len = sizeof buf - 1;
+		memcpy(buf + len - (sizeof cut - 1), cut, sizeof cut - 1);
+	}
+
+	if (suffix)
+	{
+		n = snprintf(buf + len, sizeof buf - len, "%s", suffix);
+		len += (len + n < sizeof buf) ? n : sizeof buf - 1 - len;
+	}
 
-	if (suffix) printf("%s", suffix);
+	ring_put(get_ring(), buf, (uint32_t)len);
 }
 
-void trace_e(const char * format, ...)
+void tracef_e(const char * format, ...)
 {
 	va_list m;
 	va_start(m, format);
@@ -29,7 +304,7 @@ void trace_e(const char * format, ...)
 	va_end(m);
 }
 
-void trace_w(const char * format, ...)
+void tracef_w(const char * format, ...)
 {
 	va_list m;
 	va_start(m, format);
@@ -37,7 +312,7 @@ void trace_w(const char * format, ...)
 	va_end(m);
 }
 
-void trace_i(const char * format, ...)
+void tracef_i(const char * format, ...)
 {
 	va_list m;
 	va_start(m, format);
@@ -45,7 +320,7 @@ void trace_i(const char * format, ...)
 	va_end(m);
 }
 
-void trace_v(const char * format, ...)
+void tracef_v(const char * format, ...)
 {
 	va_list m;
 	va_start(m, format);
@@ -53,7 +328,7 @@ void trace_v(const char * format, ...)
 	va_end(m);
 }
 
-void trace_d(const char * format, ...)
+void tracef_d(const char * format, ...)
 {
 	va_list m;
 	va_start(m, format);
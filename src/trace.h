@@ -10,14 +10,46 @@
 #define _TRACE_H_
 
 #include "types.h"
+#include "config.h"  // conf.trace
+#include "event_log.h"
 
-void trace_e(const char * format, ...); // 0 errors
-void trace_w(const char * format, ...); // 1 warning
-void trace_i(const char * format, ...); // 2 info
-void trace_v(const char * format, ...); // 3 verbose
-void trace_d(const char * format, ...); // 4 debug
+/*
+ *	The trace_x() are macros, so that the arguments aren't evaluated
+ *	unless the level is on. Levels above TRACE_MAX are compiled out,
+ *	e.g. /DTRACE_MAX=2 drops verbose and debug traces altogether.
+ *
+ *	The error, warning and info call sites also go into the event
+ *	log, whether the level is on or not.
+ */
+#ifndef TRACE_MAX
+#define TRACE_MAX  4
+#endif
+
+#define __trace(level, func, ...) \
+	(void)( (level) > TRACE_MAX || (__ev_trace(level), 0) || (int)(level) > (int)conf.trace || (func(__VA_ARGS__), 0) )
+
+#define trace_e(...)  __trace(0, tracef_e, __VA_ARGS__) // errors
+#define trace_w(...)  __trace(1, tracef_w, __VA_ARGS__) // warning
+#define trace_i(...)  __trace(2, tracef_i, __VA_ARGS__) // info
+#define trace_v(...)  __trace(3, tracef_v, __VA_ARGS__) // verbose
+#define trace_d(...)  __trace(4, tracef_d, __VA_ARGS__) // debug
+
+void tracef_e(const char * format, ...);
+void tracef_w(const char * format, ...);
+void tracef_i(const char * format, ...);
+void tracef_v(const char * format, ...);
+void tracef_d(const char * format, ...);
 
 bool api_error(const char * func, const char * format = NULL, ...);
 bool wsa_error(const char * func); // trace_e( "func() failed with {WSAGetLastError}" ); return false; 
 
+/*
+ *	Once started, the traces are queued and written out by the
+ *	tracer's thread, to conf.trace_file if it's set or to the
+ *	console otherwise. Until then, and after it's stopped, they
+ *	are written out as they come.
+ */
+bool start_tracer();
+void stop_tracer();  // flushes what's queued
+
 #endif
@@ -28,6 +28,11 @@ typedef unsigned int uint_t;
 #  define __D          / ## /
 #endif
 
+#ifdef FD_SETSIZE
+#undef FD_SETSIZE
+#endif
+#define FD_SETSIZE     256   // the engine select()s on all its connections at once
+
 #include <winsock2.h>
 #include <windows.h>
 
@@ -89,7 +89,7 @@ struct dialog_add_area : sfc_dialog
 			return;
 		}
 
-		conf.areas[token_val] = { name_val, L"" };
+		add_area(token_val, { name_val, L"" });
 		save_ini();
 
 		make_path(conf.path + L"\\" + name_val);
@@ -294,7 +294,7 @@ struct the_ui : sfc_window
 
 				if (ctrl_id == IDC_OPEN_AREA_FOLDER)
 				{
-					wstring path = conf.path + L"\\" + a.second.folder;
+					wstring path = conf.path + L"\\" + a.second->folder;
 
 					if (! folder_exists(path))
 					{
@@ -308,7 +308,7 @@ struct the_ui : sfc_window
 
 				if (ctrl_id == IDC_OPEN_AREA_PAGE)
 				{
-					auto const & url = a.second.url;
+					wstring url = get_area_url(a.second);
 
 					if (url.empty())
 					{
@@ -324,12 +324,14 @@ struct the_ui : sfc_window
 				{
 					wstring mesg =
 						L"About to remove the following backup from configuration,\nbut without removing any on-disk files -\n\n        "
-						+ a.second.folder
+						+ a.second->folder
 						+ L"\n\nProceed?";
 
 					if (MessageBox(hwnd, mesg.c_str(), APP_TITLE, MB_YESNO | MB_ICONQUESTION) == IDYES)
 					{
-						conf.areas.erase(a.first);
+						string token = a.first; // 'a' goes with it
+
+						remove_area(token);
 						save_ini();
 					}
 
@@ -401,7 +403,7 @@ struct the_ui : sfc_window
 			mii.wID = IDC_REMOVE_AREA + 1000*area_i;
 			sub_area.set_item_info(IDC_REMOVE_AREA, false, mii);
 
-			sub.insert_submenu((L"[ " + a.second.folder + L" ]").c_str(), sub_area.h, pos++, true);
+			sub.insert_submenu((L"[ " + a.second->folder + L" ]").c_str(), sub_area.h, pos++, true);
 			area_i++;
 		}
 
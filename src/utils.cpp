@@ -88,6 +88,29 @@ bool save_file(const wstring & file, const ch_range & data)
 	return true;
 }
 
+bool append_file(const wstring & file, const ch_range & data)
+{
+	HANDLE h;
+	DWORD bytes = 0;
+
+	h = CreateFile(file.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+	{
+		api_error("CreateFile", "%s", to_utf8(file).c_str());
+		return false;
+	}
+
+	if (! WriteFile(h, data.data, (dword)data.size, &bytes, NULL) || bytes != data.size)
+	{
+		api_error("WriteFile", "%s %lu %lu", to_utf8(file).c_str(), data.size, bytes);
+		CloseHandle(h);
+		return false;
+	}
+
+	CloseHandle(h);
+	return true;
+}
+
 bool read_file(const wstring & file, string & data, size_t size_cap)
 {
 	HANDLE h;
@@ -194,5 +217,19 @@ string sa_to_str(uint32_t addr, uint16_t port)
 
 string sa_to_str(const sockaddr_in & sa)
 {
-	return sa_to_str(htonl(sa.sin_addr.S_un.S_addr), htons(sa.sin_port));
+	return sa_to_str(htonl(sa.sin_addr.s_addr), htons(sa.sin_port));
+}
+
+//
+uint64_t get_usec()
+{
+	static uint64_t freq = 0;
+	uint64_t now;
+
+	if (! freq)
+		QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&now);
+
+	return (now / freq) * 1000000 + (now % freq) * 1000000 / freq;
 }
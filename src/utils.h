@@ -19,6 +19,7 @@ bool get_local_app_data(wstring & path);
 bool folder_exists(const wstring & path);
 bool make_path(const wstring & path);
 bool save_file(const wstring & file, const ch_range & data);
+bool append_file(const wstring & file, const ch_range & data);
 bool read_file(const wstring & file, string & data, size_t size_cap = 1024*1024);
 
 // string conversions
@@ -31,8 +32,13 @@ inline wstring to_wstr(const string  & str) { return to_wstr(str.data(), str.siz
 
 // string formatting
 
+string stringf(const char * format, ...); // import from libp
 string ip_to_str(uint32_t addr);
 string sa_to_str(uint32_t addr, uint16_t port);
 string sa_to_str(const sockaddr_in & sa);
 
+// time
+
+uint64_t get_usec(); // monotonic
+
 #endif
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include "trace.h"
 #include "config.h"
 #include "console.h"
+#include "event_log.h"
 
 #include "engine.h"
 #include "ui.h"
@@ -53,12 +54,29 @@ int wmain_alt(int argc, wchar_t ** argv)
 	if (! parse_args(argc, argv))
 		return 30;
 
+	if (conf.event_dump.size())
+	{
+		show_console();
+
+		if (! dump_event_log(conf.event_dump))
+			return 35;
+
+		printf("\nPress Enter to exit...");
+		getchar();
+		return 0;
+	}
+
 	if (! load_ini())
 		return 40;
 
+	if (! start_tracer())
+		return 45;
+
 	if (! make_path(conf.path))
 		return 50;
 
+	open_event_log(); // not fatal
+
 	if (! init_engine())
 		return 60;
 
@@ -94,6 +112,9 @@ int wmain_app(int argc, wchar_t ** argv)
 {
 	int rc = wmain_alt(argc, argv);
 
+	close_event_log();
+	stop_tracer();
+
 	if (rc != 0)
 	{
 		show_console(true);